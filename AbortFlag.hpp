@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace fantom
+{
+
+	/// Flag the integration loops poll to stop early: the abortFlag fantom passes to execute, an
+	/// atomic flag that another thread sets, e.g. the interaction thread of a view, or none.
+	/// Reads like the pointer it replaces, abortFlag && *abortFlag.
+	class AbortFlag {
+
+	public:
+		AbortFlag( std::nullptr_t = nullptr ) :
+			m_flag( nullptr ),
+			m_atomic( nullptr )
+		{
+
+		}
+
+		AbortFlag( const volatile bool* flag ) :
+			m_flag( flag ),
+			m_atomic( nullptr )
+		{
+
+		}
+
+		AbortFlag( const std::atomic< bool >* flag ) :
+			m_flag( nullptr ),
+			m_atomic( flag )
+		{
+
+		}
+
+		/// Whether there is a flag at all.
+		explicit operator bool() const {
+			return m_flag || m_atomic;
+		}
+
+		/// Whether the flag is set; requires one.
+		bool operator*() const {
+			return m_atomic ? m_atomic->load( std::memory_order_relaxed ) : *m_flag;
+		}
+
+	private:
+		const volatile bool* m_flag;
+		const std::atomic< bool >* m_atomic;
+	};
+}
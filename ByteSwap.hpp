@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#include <immintrin.h>
+#define BYTESWAP_X86
+#endif
+
+namespace fantom
+{
+
+	namespace detail
+	{
+		// Scalar reference, also used for the tails of the SIMD loops.
+		template< size_t Bytes >
+		inline void swapBytesScalar( const char* src, char* dst, size_t count ) {
+			for( size_t i=0; i<count; i++ ) {
+				if( Bytes == 4 ) {
+					uint32_t v;
+					std::memcpy( &v, src + 4*i, 4 );
+					v = __builtin_bswap32( v );
+					std::memcpy( dst + 4*i, &v, 4 );
+				} else {
+					uint64_t v;
+					std::memcpy( &v, src + 8*i, 8 );
+					v = __builtin_bswap64( v );
+					std::memcpy( dst + 8*i, &v, 8 );
+				}
+			}
+		}
+
+#ifdef BYTESWAP_X86
+		template< size_t Bytes >
+		__attribute__(( target( "avx2" ) ))
+		inline void swapBytesAVX2( const char* src, char* dst, size_t count ) {
+			const __m256i mask = Bytes == 4 ?
+				_mm256_setr_epi8( 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+								  3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 ) :
+				_mm256_setr_epi8( 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+								  7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 );
+			const size_t perVector = 32 / Bytes;
+			size_t i = 0;
+			for( ; i + 4 * perVector <= count; i += 4 * perVector ) {
+				const __m256i* s = reinterpret_cast< const __m256i* >( src + i * Bytes );
+				__m256i* d = reinterpret_cast< __m256i* >( dst + i * Bytes );
+				__m256i a = _mm256_loadu_si256( s + 0 );
+				__m256i b = _mm256_loadu_si256( s + 1 );
+				__m256i c = _mm256_loadu_si256( s + 2 );
+				__m256i e = _mm256_loadu_si256( s + 3 );
+				_mm256_storeu_si256( d + 0, _mm256_shuffle_epi8( a, mask ) );
+				_mm256_storeu_si256( d + 1, _mm256_shuffle_epi8( b, mask ) );
+				_mm256_storeu_si256( d + 2, _mm256_shuffle_epi8( c, mask ) );
+				_mm256_storeu_si256( d + 3, _mm256_shuffle_epi8( e, mask ) );
+			}
+			for( ; i + perVector <= count; i += perVector ) {
+				__m256i a = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( src + i * Bytes ) );
+				_mm256_storeu_si256( reinterpret_cast< __m256i* >( dst + i * Bytes ), _mm256_shuffle_epi8( a, mask ) );
+			}
+			swapBytesScalar< Bytes >( src + i * Bytes, dst + i * Bytes, count - i );
+		}
+
+		template< size_t Bytes >
+		__attribute__(( target( "ssse3" ) ))
+		inline void swapBytesSSSE3( const char* src, char* dst, size_t count ) {
+			const __m128i mask = Bytes == 4 ?
+				_mm_setr_epi8( 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 ) :
+				_mm_setr_epi8( 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 );
+			const size_t perVector = 16 / Bytes;
+			size_t i = 0;
+			for( ; i + perVector <= count; i += perVector ) {
+				__m128i a = _mm_loadu_si128( reinterpret_cast< const __m128i* >( src + i * Bytes ) );
+				_mm_storeu_si128( reinterpret_cast< __m128i* >( dst + i * Bytes ), _mm_shuffle_epi8( a, mask ) );
+			}
+			swapBytesScalar< Bytes >( src + i * Bytes, dst + i * Bytes, count - i );
+		}
+#endif
+
+		template< size_t Bytes >
+		inline void swapBytes( const char* src, char* dst, size_t count ) {
+#ifdef BYTESWAP_X86
+			static const bool hasAVX2 = __builtin_cpu_supports( "avx2" );
+			static const bool hasSSSE3 = __builtin_cpu_supports( "ssse3" );
+			if( hasAVX2 ) return swapBytesAVX2< Bytes >( src, dst, count );
+			if( hasSSSE3 ) return swapBytesSSSE3< Bytes >( src, dst, count );
+#endif
+			swapBytesScalar< Bytes >( src, dst, count );
+		}
+	}
+
+	/// Converts count values of type S (float or double) stored at src in the given byte order
+	/// into host order and stores them as T. src does not need to be aligned.
+	template< typename S, typename T >
+	inline void loadValues( const char* src, T* dst, size_t count, bool bigEndian ) {
+		static_assert( sizeof( S ) == 4 || sizeof( S ) == 8, "unsupported element size" );
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		const bool swap = !bigEndian;
+#else
+		const bool swap = bigEndian;
+#endif
+		if( std::is_same< S, T >::value ) {
+			if( swap ) detail::swapBytes< sizeof( S ) >( src, reinterpret_cast< char* >( dst ), count );
+			else std::memcpy( dst, src, count * sizeof( S ) );
+			return;
+		}
+
+		// swap through a small buffer that stays in L1, then narrow or widen
+		const size_t blockSize = 1024;
+		S block[blockSize];
+		for( size_t i=0; i<count; i+=blockSize ) {
+			size_t n = std::min( blockSize, count - i );
+			if( swap ) detail::swapBytes< sizeof( S ) >( src + i * sizeof( S ), reinterpret_cast< char* >( block ), n );
+			else std::memcpy( block, src + i * sizeof( S ), n * sizeof( S ) );
+			for( size_t j=0; j<n; j++ ) {
+				dst[i+j] = static_cast< T >( block[j] );
+			}
+		}
+	}
+
+	/// Converts count big-endian values of type S at src into T.
+	template< typename S, typename T >
+	inline void loadBigEndian( const char* src, T* dst, size_t count ) {
+		loadValues< S >( src, dst, count, true );
+	}
+}
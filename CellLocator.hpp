@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace fantom
+{
+
+	/// Uniform bins over the bounding boxes of a set of cells. Every bin lists the cells whose
+	/// box overlaps it, so locating a point only tests the few cells of one bin. There are at most
+	/// about twice as many bins as cells and they are built in parallel. The boxes are kept in
+	/// single precision, rounded outwards so that they still contain their cells.
+	class CellLocator {
+
+	public:
+		static const size_t none = size_t( -1 );
+
+		CellLocator() :
+			m_numCells( 0 )
+		{
+			for( size_t d=0; d<3; d++ ) m_bins[d] = 0;
+		}
+
+		/// bounds( cell, lower, upper ) writes the bounding box of cell.
+		template< typename Bounds >
+		CellLocator( size_t numCells, Bounds bounds ) :
+			m_numCells( numCells ),
+			m_boxes( 6 * numCells )
+		{
+			#pragma omp parallel for
+			for( long long c=0; c<(long long)numCells; c++ ) {
+				double lower[3], upper[3];
+				bounds( size_t( c ), lower, upper );
+				for( size_t d=0; d<3; d++ ) {
+					m_boxes[6*c+d] = roundDown( lower[d] );
+					m_boxes[6*c+3+d] = roundUp( upper[d] );
+				}
+			}
+			buildBins();
+		}
+
+		size_t numCells() const {
+			return m_numCells;
+		}
+
+		/// Calls test( cell ) for the cells whose box contains p until one accepts, and returns
+		/// that cell. Returns none if no cell accepts.
+		template< typename Test >
+		size_t find( const double p[3], Test test ) const {
+			size_t bin[3];
+			for( size_t d=0; d<3; d++ ) {
+				if( m_bins[d] == 0 || !( p[d] >= m_lower[d] && p[d] <= m_upper[d] ) ) return none;
+				bin[d] = std::min( size_t( ( p[d] - m_lower[d] ) * m_scale[d] ), m_bins[d] - 1 );
+			}
+			size_t b = bin[0] + m_bins[0] * ( bin[1] + m_bins[1] * bin[2] );
+			for( size_t i=m_offsets[b]; i<m_offsets[b+1]; i++ ) {
+				size_t cell = m_cells[i];
+				const float* box = &m_boxes[6*cell];
+				if( p[0] < box[0] || p[1] < box[1] || p[2] < box[2] || p[0] > box[3] || p[1] > box[4] || p[2] > box[5] ) continue;
+				if( test( cell ) ) return cell;
+			}
+			return none;
+		}
+
+		size_t memoryUsed() const {
+			return m_boxes.size() * sizeof( float ) + ( m_offsets.size() + m_cells.size() ) * sizeof( size_t );
+		}
+
+	private:
+		size_t m_numCells;
+		std::vector< float > m_boxes;
+		double m_lower[3];
+		double m_upper[3];
+		double m_scale[3];
+		size_t m_bins[3];
+		std::vector< size_t > m_offsets;
+		std::vector< size_t > m_cells;
+
+		static float roundDown( double x ) {
+			float f = float( x );
+			return double( f ) > x ? std::nextafter( f, -std::numeric_limits< float >::infinity() ) : f;
+		}
+
+		static float roundUp( double x ) {
+			float f = float( x );
+			return double( f ) < x ? std::nextafter( f, std::numeric_limits< float >::infinity() ) : f;
+		}
+
+		void buildBins() {
+			for( size_t d=0; d<3; d++ ) m_bins[d] = 0;
+			if( m_numCells == 0 ) return;
+
+			for( size_t d=0; d<3; d++ ) {
+				m_lower[d] = m_boxes[d];
+				m_upper[d] = m_boxes[3+d];
+			}
+			#pragma omp parallel
+			{
+				double lower[3] = { m_lower[0], m_lower[1], m_lower[2] };
+				double upper[3] = { m_upper[0], m_upper[1], m_upper[2] };
+				#pragma omp for nowait
+				for( long long c=0; c<(long long)m_numCells; c++ ) {
+					for( size_t d=0; d<3; d++ ) {
+						lower[d] = std::min< double >( lower[d], m_boxes[6*c+d] );
+						upper[d] = std::max< double >( upper[d], m_boxes[6*c+3+d] );
+					}
+				}
+				#pragma omp critical
+				for( size_t d=0; d<3; d++ ) {
+					m_lower[d] = std::min( m_lower[d], lower[d] );
+					m_upper[d] = std::max( m_upper[d], upper[d] );
+				}
+			}
+
+			// cubic bins of the size of an average cell, flat extents get a single layer
+			double extent[3];
+			double volume = 1.0;
+			size_t flat = 0;
+			for( size_t d=0; d<3; d++ ) {
+				extent[d] = m_upper[d] - m_lower[d];
+				if( extent[d] > 0.0 ) volume *= extent[d];
+				else flat++;
+			}
+			double size = std::pow( volume / m_numCells, 1.0 / ( 3 - std::min< size_t >( flat, 2 ) ) );
+			for( size_t d=0; d<3; d++ ) {
+				m_bins[d] = extent[d] > 0.0 ? size_t( std::max( std::ceil( extent[d] / size ), 1.0 ) ) : 1;
+			}
+			// rounding up per axis multiplies, e.g. on slabs a few cells thick, so all axes shrink
+			// alike until the total is bounded by the cells
+			const double maxBins = 2.0 * m_numCells + 8.0;
+			for( double total = double( m_bins[0] ) * m_bins[1] * m_bins[2]; total > maxBins; total = double( m_bins[0] ) * m_bins[1] * m_bins[2] ) {
+				size_t axes = 0;
+				for( size_t d=0; d<3; d++ ) axes += m_bins[d] > 1;
+				double shrink = std::pow( maxBins / total, 1.0 / axes );
+				for( size_t d=0; d<3; d++ ) m_bins[d] = std::max< size_t >( size_t( m_bins[d] * shrink ), 1 );
+			}
+			for( size_t d=0; d<3; d++ ) {
+				m_scale[d] = extent[d] > 0.0 ? m_bins[d] / extent[d] : 0.0;
+			}
+
+			// counting sort of the cells into the bins they overlap
+			size_t numBins = m_bins[0] * m_bins[1] * m_bins[2];
+			m_offsets.assign( numBins + 1, 0 );
+			forEachBin( [this]( size_t, size_t b ) {
+				#pragma omp atomic
+				m_offsets[b+1]++;
+			} );
+			for( size_t b=0; b<numBins; b++ ) m_offsets[b+1] += m_offsets[b];
+
+			m_cells.resize( m_offsets[numBins] );
+			std::vector< size_t > cursor( m_offsets.begin(), m_offsets.end() - 1 );
+			forEachBin( [this, &cursor]( size_t cell, size_t b ) {
+				size_t slot;
+				#pragma omp atomic capture
+				slot = cursor[b]++;
+				m_cells[slot] = cell;
+			} );
+
+			// threads fill the bins in any order
+			#pragma omp parallel for schedule( dynamic, 256 )
+			for( long long b=0; b<(long long)numBins; b++ ) {
+				std::sort( m_cells.begin() + m_offsets[b], m_cells.begin() + m_offsets[b+1] );
+			}
+		}
+
+		// Calls f( cell, bin ) in parallel for every bin the box of a cell overlaps.
+		template< typename F >
+		void forEachBin( F f ) const {
+			#pragma omp parallel for
+			for( long long c=0; c<(long long)m_numCells; c++ ) {
+				size_t first[3], last[3];
+				for( size_t d=0; d<3; d++ ) {
+					first[d] = std::min( size_t( ( m_boxes[6*c+d] - m_lower[d] ) * m_scale[d] ), m_bins[d] - 1 );
+					last[d] = std::min( size_t( ( m_boxes[6*c+3+d] - m_lower[d] ) * m_scale[d] ), m_bins[d] - 1 );
+				}
+				for( size_t k=first[2]; k<=last[2]; k++ ) {
+					for( size_t j=first[1]; j<=last[1]; j++ ) {
+						for( size_t i=first[0]; i<=last[0]; i++ ) {
+							f( size_t( c ), i + m_bins[0] * ( j + m_bins[1] * k ) );
+						}
+					}
+				}
+			}
+		}
+	};
+}
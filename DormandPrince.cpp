@@ -0,0 +1,65 @@
+#include <fantom/algorithm.hpp>
+#include <fantom/register.hpp>
+#include <fantom/graphics.hpp>
+#include <fantom/fields.hpp>
+
+#include "Integrator.cpp"
+
+using namespace fantom;
+
+namespace {
+
+	class DormandPrince : public Integrator {
+
+	public:
+		struct Options : public Integrator::Options {
+			Options( fantom::Options::Control& control ) :
+				Integrator::Options( control )
+			{
+				add< float >( "Absolute tolerance", "Allowed error per step", 1e-6 );
+				add< float >( "Relative tolerance", "Allowed error per step relative to the position", 1e-6 );
+				add< float >( "Min step", "Smallest step size, steps this small are accepted regardless of their error", 1e-5 );
+				add< float >( "Max step", "Largest step size", 1.0 );
+			}
+		};
+
+		DormandPrince( InitData& data ) :
+			Integrator( data )
+		{
+
+		}
+
+		void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
+			Integrator::execute( options, abortFlag );
+			if( !m_seedLine || !m_field ) return;
+
+			// check seedline vs grid bounding box
+			m_numPoints = m_seedLine->getNumPoints();
+			if( !insideGrid( m_grid, m_seedLine->getPointOnLine( 0, 0 ) ) ||
+				!insideGrid( m_grid, m_seedLine->getPointOnLine( 0, m_numPoints-1 ) ) )
+			{
+				infoLog() << "Seed points out of bounds" << std::endl;
+				return;
+			}
+
+			integration::Tolerance tolerance;
+			tolerance.absolute = options.get< float >( "Absolute tolerance" );
+			tolerance.relative = options.get< float >( "Relative tolerance" );
+			tolerance.minStep = options.get< float >( "Min step" );
+			tolerance.maxStep = std::max( options.get< float >( "Max step" ), options.get< float >( "Min step" ) );
+			IntegrationCache::describe( m_parameters, "absolute", tolerance.absolute );
+			IntegrationCache::describe( m_parameters, "relative", tolerance.relative );
+			IntegrationCache::describe( m_parameters, "min step", tolerance.minStep );
+			IntegrationCache::describe( m_parameters, "max step", tolerance.maxStep );
+
+			// every line starts at the step size option and adapts its own copy
+			integrate( integration::AdaptiveRK45< Vector3 >( m_stepSize, tolerance ), false, abortFlag );
+
+			Integrator::makeLineSet( options );
+		}
+
+	};
+
+	AlgorithmRegister< DormandPrince > reg( "VisPraktikum/DormandPrince", "Adaptive Runge-Kutta (Dormand-Prince) integration" );
+
+}
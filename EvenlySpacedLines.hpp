@@ -0,0 +1,412 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <omp.h>
+
+#include "IntegrationCore.hpp"
+#include "LineArena.hpp"
+
+namespace fantom
+{
+
+	/// Points hashed into cubic cells, for asking whether any lies close to a position. Reading
+	/// is thread-safe as long as nobody inserts. V needs operator[] for its coordinates.
+	template< typename V >
+	class SpatialHash {
+
+	public:
+		/// Answers queries up to distances of cellSize.
+		SpatialHash( double cellSize ) :
+			m_inverseCellSize( 1.0 / cellSize ),
+			m_size( 0 )
+		{
+
+		}
+
+		size_t size() const {
+			return m_size;
+		}
+
+		void insert( const V& p ) {
+			m_cells[ key( cell( p, 0 ), cell( p, 1 ), cell( p, 2 ) ) ].push_back( p );
+			m_size++;
+		}
+
+		/// Whether a point lies closer than distance to p, which must be at most the cell size.
+		bool near( const V& p, double distance ) const {
+			const long long c[3] = { cell( p, 0 ), cell( p, 1 ), cell( p, 2 ) };
+			const double squared = distance * distance;
+			for( long long k=c[2]-1; k<=c[2]+1; k++ ) {
+				for( long long j=c[1]-1; j<=c[1]+1; j++ ) {
+					for( long long i=c[0]-1; i<=c[0]+1; i++ ) {
+						auto found = m_cells.find( key( i, j, k ) );
+						if( found == m_cells.end() ) continue;
+						for( const V& q : found->second ) {
+							double d2 = 0.0;
+							for( size_t d=0; d<3; d++ ) d2 += ( p[d] - q[d] ) * ( p[d] - q[d] );
+							if( d2 < squared ) return true;
+						}
+					}
+				}
+			}
+			return false;
+		}
+
+		/// Key of cell (i,j,k): 21 bits per axis, cells that wrap around share a bucket, which
+		/// costs time but not correctness.
+		static uint64_t key( long long i, long long j, long long k ) {
+			const uint64_t mask = ( uint64_t( 1 ) << 21 ) - 1;
+			return ( uint64_t( i ) & mask ) | ( ( uint64_t( j ) & mask ) << 21 ) | ( ( uint64_t( k ) & mask ) << 42 );
+		}
+
+	private:
+		double m_inverseCellSize;
+		size_t m_size;
+		std::unordered_map< uint64_t, std::vector< V > > m_cells;
+
+		long long cell( const V& p, size_t d ) const {
+			return (long long)std::floor( p[d] * m_inverseCellSize );
+		}
+	};
+
+	/// SpatialHash that threads insert into and query at the same time, for the lines of one
+	/// wave. Cells map onto a fixed number of buckets with a lock each, so inserting never
+	/// rehashes and threads only wait for each other in the same bucket. Every point carries the
+	/// line it belongs to, and queries only see the points of the lines before a given one.
+	template< typename V >
+	class ConcurrentSpatialHash {
+
+	public:
+		ConcurrentSpatialHash( double cellSize, size_t numBuckets ) :
+			m_inverseCellSize( 1.0 / cellSize ),
+			m_numBuckets( std::max< size_t >( numBuckets, 1 ) ),
+			m_buckets( new Bucket[ m_numBuckets ] )
+		{
+
+		}
+
+		void clear() {
+			for( size_t b=0; b<m_numBuckets; b++ ) m_buckets[b].points.clear();
+		}
+
+		void insert( const V& p, size_t line ) {
+			Bucket& bucket = m_buckets[ index( cell( p, 0 ), cell( p, 1 ), cell( p, 2 ) ) ];
+			std::lock_guard< std::mutex > lock( bucket.mutex );
+			bucket.points.emplace_back( p, line );
+		}
+
+		/// Whether a point of a line before line lies closer than distance to p, which must be at
+		/// most the cell size.
+		bool near( const V& p, double distance, size_t line ) const {
+			const long long c[3] = { cell( p, 0 ), cell( p, 1 ), cell( p, 2 ) };
+			const double squared = distance * distance;
+			for( long long k=c[2]-1; k<=c[2]+1; k++ ) {
+				for( long long j=c[1]-1; j<=c[1]+1; j++ ) {
+					for( long long i=c[0]-1; i<=c[0]+1; i++ ) {
+						const Bucket& bucket = m_buckets[ index( i, j, k ) ];
+						std::lock_guard< std::mutex > lock( bucket.mutex );
+						for( const std::pair< V, size_t >& q : bucket.points ) {
+							if( q.second >= line ) continue;
+							double d2 = 0.0;
+							for( size_t d=0; d<3; d++ ) d2 += ( p[d] - q.first[d] ) * ( p[d] - q.first[d] );
+							if( d2 < squared ) return true;
+						}
+					}
+				}
+			}
+			return false;
+		}
+
+	private:
+		struct alignas( 64 ) Bucket {
+			mutable std::mutex mutex;
+			std::vector< std::pair< V, size_t > > points;
+		};
+
+		double m_inverseCellSize;
+		size_t m_numBuckets;
+		std::unique_ptr< Bucket[] > m_buckets;
+
+		long long cell( const V& p, size_t d ) const {
+			return (long long)std::floor( p[d] * m_inverseCellSize );
+		}
+
+		// Fibonacci hashing spreads neighbouring cells over the buckets
+		size_t index( long long i, long long j, long long k ) const {
+			return size_t( ( SpatialHash< V >::key( i, j, k ) * 0x9e3779b97f4a7c15ull ) >> 20 ) % m_numBuckets;
+		}
+	};
+
+	namespace integration
+	{
+
+		/// Outcome of integrateEvenlySpaced.
+		struct SpacingStats {
+			size_t candidates = 0;	///< seeds tried, given and generated
+			size_t lines = 0;		///< lines kept
+			size_t steps = 0;		///< steps integrated, including those of lines cut or dropped later
+		};
+
+		namespace detail
+		{
+			// Two unit vectors perpendicular to the unit vector t and to each other.
+			inline void perpendicular( const double t[3], double u[3], double w[3] ) {
+				size_t axis = 0;
+				for( size_t d=1; d<3; d++ ) {
+					if( std::abs( t[d] ) < std::abs( t[axis] ) ) axis = d;
+				}
+				double length = 0.0;
+				for( size_t d=0; d<3; d++ ) {
+					u[d] = ( d == axis ? 1.0 : 0.0 ) - t[axis] * t[d];
+					length += u[d] * u[d];
+				}
+				length = std::sqrt( length );
+				for( size_t d=0; d<3; d++ ) u[d] /= length;
+				w[0] = t[1] * u[2] - t[2] * u[1];
+				w[1] = t[2] * u[0] - t[0] * u[2];
+				w[2] = t[0] * u[1] - t[1] * u[0];
+			}
+
+			template< typename V >
+			inline double distance( const V& a, const V& b ) {
+				double d2 = 0.0;
+				for( size_t d=0; d<3; d++ ) d2 += ( a[d] - b[d] ) * ( a[d] - b[d] );
+				return std::sqrt( d2 );
+			}
+
+			// Ends a line where it comes back to itself, e.g. on a closed orbit: its own samples
+			// are tested once they lie selfDistance behind along the line.
+			template< typename V >
+			class SelfTest {
+
+			public:
+				SelfTest( const V& seed, double separation, double test, double selfDistance ) :
+					m_own( separation ),
+					m_previous( seed ),
+					m_length( 0.0 ),
+					m_test( test ),
+					m_selfDistance( selfDistance )
+				{
+
+				}
+
+				// Appends x to the line, whether it lies closer than test to the samples behind.
+				bool operator()( const V& x ) {
+					m_length += distance( m_previous, x );
+					m_previous = x;
+					m_recent.emplace_back( m_length, x );
+					while( m_length - m_recent.front().first > m_selfDistance ) {
+						m_own.insert( m_recent.front().second );
+						m_recent.pop_front();
+					}
+					return m_own.near( x, m_test );
+				}
+
+			private:
+				SpatialHash< V > m_own;
+				std::deque< std::pair< double, V > > m_recent;
+				V m_previous;
+				double m_length;
+				double m_test;
+				double m_selfDistance;
+			};
+		}
+
+		/// Evenly-spaced streamlines after Jobard and Lefer. Seeds closer than separation to a
+		/// line are skipped, and lines end where they come within half the separation of another
+		/// line or of an earlier part of themselves. Every line then offers new seeds at the
+		/// separation from it, every separation along it, in four directions perpendicular to it.
+		/// The given seeds are tried first, in order, then the generated ones, until none is left.
+		///
+		/// Lines are integrated in parallel in waves of seeds, testing against the lines of the
+		/// earlier waves in a SpatialHash of their samples. The lines of a wave are then kept or
+		/// cut one after the other, so the result doesn't depend on the threads. The samples are
+		/// at most a quarter of the separation apart, also where the steps are larger.
+		///
+		/// While a wave runs its lines share their samples in a ConcurrentSpatialHash, and a line
+		/// stops early at the samples of the lines before it in the wave, which take precedence
+		/// when they are kept, instead of running on until it is cut. Where such a line turns out
+		/// not to be kept there, the line is continued from its last sample while being kept, with
+		/// the stepper and step count it stopped with, so it ends up as without stopping early.
+		///
+		/// The result goes into vertices, line i from offsets[i] to offsets[i+1] starting at its
+		/// seed. makeField and normalize are those of integrateLines, V needs operator[] besides
+		/// what the steppers need. Lines end early once abortFlag is set.
+		template< typename Stepper, typename V, typename MakeField >
+		inline SpacingStats integrateEvenlySpaced( const Stepper& stepper, bool normalize, const std::vector< V >& seeds, size_t maxSteps, double separation,
+												   AbortFlag abortFlag, MakeField makeField, std::vector< V >& vertices, std::vector< size_t >& offsets ) {
+			const double test = 0.5 * separation;
+			const double sampling = 0.25 * separation;
+			const double selfDistance = 2.0 * separation;
+			const size_t waveSize = 16 * omp_get_max_threads();
+
+			SpacingStats stats;
+			SpatialHash< V > hash( separation );
+			ConcurrentSpatialHash< V > waveHash( separation, 64 * waveSize );
+			std::deque< V > candidates( seeds.begin(), seeds.end() );
+			vertices.clear();
+			offsets.assign( 1, 0 );
+
+			// A new seed lies exactly at the separation from the line it came from.
+			auto free = [&hash, separation]( const V& seed ) {
+				return !hash.near( seed, 0.999 * separation );
+			};
+
+			// Adds the segment from a to b to the hash, subdivided to the sampling distance.
+			auto insert = [&hash, sampling]( const V& a, const V& b ) {
+				const size_t parts = size_t( std::ceil( detail::distance( a, b ) / sampling ) );
+				for( size_t s=1; s<parts; s++ ) {
+					const double t = double( s ) / parts;
+					hash.insert( V{ a[0] + t * ( b[0] - a[0] ), a[1] + t * ( b[1] - a[1] ), a[2] + t * ( b[2] - a[2] ) } );
+				}
+				hash.insert( b );
+			};
+
+			std::vector< V > wave;
+			std::vector< V > waveVertices;
+			std::vector< size_t > waveOffsets;
+			std::vector< V > line;
+			std::vector< double > arc;
+			while( !candidates.empty() && !( abortFlag && *abortFlag ) ) {
+				wave.clear();
+				while( !candidates.empty() && wave.size() < waveSize ) {
+					stats.candidates++;
+					if( free( candidates.front() ) ) wave.push_back( candidates.front() );
+					candidates.pop_front();
+				}
+				if( wave.empty() ) continue;
+
+				LineArena< V > arena( wave.size() );
+				for( size_t i=0; i<wave.size(); i++ ) {
+					arena.push( i, wave[i] );
+					waveHash.insert( wave[i], i );
+				}
+				// what a line stopped early by the wave needs to go on
+				std::vector< Stepper > steppers( wave.size(), stepper );
+				std::vector< StepLimit > limits( wave.size(), StepLimit( maxSteps, abortFlag ) );
+				std::vector< detail::SelfTest< V > > selfTests;
+				selfTests.reserve( wave.size() );
+				for( size_t i=0; i<wave.size(); i++ ) {
+					selfTests.emplace_back( wave[i], separation, test, selfDistance );
+				}
+				std::vector< char > stopped( wave.size(), 0 );
+				size_t steps = 0;
+				#pragma omp parallel reduction( + : steps )
+				{
+					auto field = makeField();
+					Normalized< decltype( field ) > direction( field );
+
+					#pragma omp for schedule( dynamic )
+					for( long long i=0; i<(long long)wave.size(); i++ ) {
+						Stepper& lineStepper = steppers[i];
+						StepLimit& limit = limits[i];
+						V previous = wave[i];
+						auto terminate = [&]( const V& x ) {
+							// published subdivided like in hash, for the lines after this one
+							const size_t parts = size_t( std::ceil( detail::distance( previous, x ) / sampling ) );
+							for( size_t s=1; s<=parts; s++ ) {
+								const double t = double( s ) / parts;
+								waveHash.insert( V{ previous[0] + t * ( x[0] - previous[0] ), previous[1] + t * ( x[1] - previous[1] ), previous[2] + t * ( x[2] - previous[2] ) }, size_t( i ) );
+							}
+							previous = x;
+							const bool self = selfTests[i]( x );
+							if( limit( x ) || hash.near( x, test ) || self ) return true;
+							stopped[i] = waveHash.near( x, test, size_t( i ) );
+							return bool( stopped[i] );
+						};
+						auto sink = [&arena, i]( const V& x ) { arena.push( i, x ); };
+						V x = wave[i];
+						if( normalize ) steps += integrateLine( lineStepper, direction, x, terminate, sink );
+						else steps += integrateLine( lineStepper, field, x, terminate, sink );
+					}
+				}
+				stats.steps += steps;
+				arena.merge( waveVertices, waveOffsets );
+				waveHash.clear();
+
+				for( size_t i=0; i<wave.size(); i++ ) {
+					if( !free( waveVertices[ waveOffsets[i] ] ) ) continue;
+					line.assign( waveVertices.begin() + waveOffsets[i], waveVertices.begin() + waveOffsets[i+1] );
+
+					// cut where the line meets an earlier one, or itself: its own samples join
+					// the hash once they lie selfDistance behind along the line
+					size_t end = 1;
+					size_t pending = 0;
+					double length = 0.0;
+					arc.assign( 1, 0.0 );
+					auto keep = [&]() {
+						if( hash.near( line[end], test ) ) return false;
+						length += detail::distance( line[end-1], line[end] );
+						arc.push_back( length );
+						while( pending + 1 < end && length - arc[ pending + 1 ] > selfDistance ) {
+							if( pending == 0 ) hash.insert( line[0] );
+							insert( line[pending], line[pending+1] );
+							pending++;
+						}
+						end++;
+						return true;
+					};
+					while( end < line.size() && keep() ) {}
+
+					// stopped early at a line of the wave that doesn't reach here: it goes on as if
+					// it hadn't stopped, where the hash of the earlier waves ends it keep() does
+					if( stopped[i] && end == line.size() && !( abortFlag && *abortFlag ) ) {
+						auto field = makeField();
+						Normalized< decltype( field ) > direction( field );
+						auto terminate = [&]( const V& x ) {
+							const bool cut = !keep();
+							return limits[i]( x ) || cut || selfTests[i]( x );
+						};
+						auto sink = [&line]( const V& x ) { line.push_back( x ); };
+						V x = line.back();
+						if( normalize ) stats.steps += integrateLine( steppers[i], direction, x, terminate, sink );
+						else stats.steps += integrateLine( steppers[i], field, x, terminate, sink );
+					}
+
+					// a line of one sample hasn't inserted any yet
+					if( end < 2 ) continue;
+					if( pending == 0 ) hash.insert( line[0] );
+					for( ; pending+1<end; pending++ ) {
+						insert( line[pending], line[pending+1] );
+					}
+
+					// new seeds beside the line
+					double next = 0.0;
+					for( size_t j=0; j<end; j++ ) {
+						if( arc[j] < next ) continue;
+						next = arc[j] + separation;
+						const V& a = line[ j > 0 ? j - 1 : j ];
+						const V& b = line[ j + 1 < end ? j + 1 : j ];
+						double t[3], u[3], w[3];
+						const double span = detail::distance( a, b );
+						if( !( span > 0.0 ) ) continue;
+						for( size_t d=0; d<3; d++ ) t[d] = ( b[d] - a[d] ) / span;
+						detail::perpendicular( t, u, w );
+						const V& x = line[j];
+						for( const double* n : { u, w } ) {
+							for( double sign : { 1.0, -1.0 } ) {
+								const double s = sign * separation;
+								candidates.push_back( V{ x[0] + s * n[0], x[1] + s * n[1], x[2] + s * n[2] } );
+							}
+						}
+					}
+
+					vertices.insert( vertices.end(), line.begin(), line.begin() + end );
+					offsets.push_back( vertices.size() );
+					stats.lines++;
+				}
+			}
+			return stats;
+		}
+	}
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <fantom/algorithm.hpp>
+#include <fantom/register.hpp>
+#include <fantom/fields.hpp>
+
+#include "FiniteTimeLyapunov.hpp"
+#include "IntegrationFields.hpp"
+#include "PacketIntegration.hpp"
+
+using namespace fantom;
+
+namespace {
+
+	class FTLE : public DataAlgorithm {
+
+	public:
+		struct Options : public DataAlgorithm::Options {
+			Options( fantom::Options::Control& control ) :
+				DataAlgorithm::Options( control )
+			{
+				add< TensorFieldInterpolated< 3, Vector3 > >( "Field", "3D vector field" );
+				add< int >( "Resolution x", "Nodes of the output grid along x, spread over the bounding box of the field", 64 );
+				add< int >( "Resolution y", "Nodes of the output grid along y", 64 );
+				add< int >( "Resolution z", "Nodes of the output grid along z, 1 for a slice through the middle", 64 );
+				add< float >( "Integration time", "Time every particle is advected for, negative for backward FTLE", 1.0 );
+				add< float >( "Step size", "Largest integration step size", 0.01 );
+				add< bool >( "Packets", "Advect several particles at once in SIMD lanes on uniform grids", true );
+			}
+		};
+
+		struct DataOutputs : public DataAlgorithm::DataOutputs {
+			DataOutputs( fantom::DataOutputs::Control& control ) :
+				DataAlgorithm::DataOutputs( control )
+			{
+				add< Grid< 3 > >( "grid" );
+				add< TensorFieldBase >( "FTLE" );
+			}
+		};
+
+		FTLE( InitData& data ) :
+			DataAlgorithm( data )
+		{
+
+		}
+
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
+			std::shared_ptr< const TensorFieldInterpolated< 3, Vector3 > > field = options.get< TensorFieldInterpolated< 3, Vector3 > >( "Field" );
+			if( !field ) {
+				infoLog() << "No input field!" << std::endl;
+				return;
+			}
+			std::shared_ptr< const Grid< 3 > > grid = std::dynamic_pointer_cast< const Grid< 3 > >( field->domain() );
+			if( !grid ) {
+				infoLog() << "No input grid!" << std::endl;
+				return;
+			}
+			double time = options.get< float >( "Integration time" );
+			double stepSize = options.get< float >( "Step size" );
+			if( time == 0.0 || !( stepSize > 0.0 ) ) {
+				infoLog() << "Integration time and step size must not be 0" << std::endl;
+				return;
+			}
+
+			// the output lattice spans the bounding box of the field's grid
+			double lower[3], upper[3];
+			for( size_t d=0; d<3; d++ ) {
+				lower[d] = std::numeric_limits< double >::infinity();
+				upper[d] = -std::numeric_limits< double >::infinity();
+			}
+			const ValueArray< Point3 >& points = grid->points();
+			for( size_t i=0; i<points.size(); i++ ) {
+				Point3 p = points[i];
+				for( size_t d=0; d<3; d++ ) {
+					lower[d] = std::min( lower[d], p[d] );
+					upper[d] = std::max( upper[d], p[d] );
+				}
+			}
+			const int resolution[3] = { options.get< int >( "Resolution x" ), options.get< int >( "Resolution y" ), options.get< int >( "Resolution z" ) };
+			Lattice lattice;
+			for( size_t d=0; d<3; d++ ) {
+				lattice.dims[d] = size_t( std::max( resolution[d], 1 ) );
+				if( lattice.dims[d] > 1 && upper[d] > lower[d] ) {
+					lattice.origin[d] = lower[d];
+					lattice.spacing[d] = ( upper[d] - lower[d] ) / double( lattice.dims[d] - 1 );
+				} else {
+					lattice.dims[d] = 1;
+					lattice.origin[d] = 0.5 * ( lower[d] + upper[d] );
+					lattice.spacing[d] = 1.0;
+				}
+			}
+
+			// particles in bricks: packets on uniform grids, otherwise one line per task sampled
+			// with the cell of the last step as location hint
+			std::vector< double > flowMap;
+			size_t steps;
+			std::shared_ptr< const StructuredVectorField > structured = structuredVectorField( field );
+			auto progress = [this]( size_t finished, size_t total ) {
+				debugLog() << "Advected " << finished << " of " << total << " particles" << std::endl;
+			};
+			if( options.get< bool >( "Packets" ) && structured && integration::supportsPackets( *structured ) ) {
+				steps = integration::advectLatticePackets( lattice, *structured, time, stepSize, &abortFlag, progress, flowMap );
+			} else {
+				if( structured ) {
+					steps = integration::advectLattice< Point3 >( lattice, time, stepSize, &abortFlag, [&]() { return HintedField( *structured ); }, progress, flowMap );
+				} else {
+					steps = integration::advectLattice< Point3 >( lattice, time, stepSize, &abortFlag, [&]() { return EvaluatorField( *field ); }, progress, flowMap );
+				}
+			}
+			if( abortFlag ) return;
+			infoLog() << "Advected " << lattice.size() << " particles in " << steps << " steps" << std::endl;
+
+			std::vector< double > ftle;
+			integration::computeFtle( lattice, flowMap, time, ftle );
+			std::vector< double >().swap( flowMap );
+
+			std::shared_ptr< const DiscreteDomain< 3 > > domain = DomainFactory::makeDomainUniform( lattice.dims, lattice.origin, lattice.spacing );
+			std::shared_ptr< const Grid< 3 > > result = DomainFactory::makeGridStructured( *domain );
+			std::vector< Tensor< double, 1 > > values( ftle.size() );
+			for( size_t i=0; i<ftle.size(); i++ ) {
+				values[i] = Tensor< double, 1 >( ftle[i] );
+			}
+			setResult( "grid", result );
+			setResult( "FTLE", DomainFactory::makeTensorField( *result, values ) );
+		}
+
+	};
+
+	AlgorithmRegister< FTLE > reg( "VisPraktikum/FTLE", "Finite-time Lyapunov exponents of the flow map on a uniform grid" );
+
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include "IntegrationCore.hpp"
+#include "IntegrationTasks.hpp"
+#include "PacketIntegration.hpp"
+#include "StructuredGrid.hpp"
+
+namespace fantom
+{
+
+	/// Uniform lattice of nodes, node (i,j,k) at origin + (i,j,k) * spacing with index
+	/// i + nx * ( j + ny * k ), like the points of a StructuredGrid.
+	struct Lattice {
+		size_t dims[3];
+		double origin[3];
+		double spacing[3];
+
+		size_t size() const {
+			return dims[0] * dims[1] * dims[2];
+		}
+
+		/// Coordinate d of node index.
+		double coordinate( size_t index, size_t d ) const {
+			const size_t stride = d == 0 ? 1 : d == 1 ? dims[0] : dims[0] * dims[1];
+			return origin[d] + double( index / stride % dims[d] ) * spacing[d];
+		}
+	};
+
+	namespace integration
+	{
+
+		/// Node indices of lattice in bricks of brick^3 nodes, one brick after the other. Particles
+		/// advected in this order start next to the ones before them, so a packet or a thread
+		/// keeps sampling the same few cells of the field instead of a row across the grid.
+		inline std::vector< size_t > brickOrder( const Lattice& lattice, size_t brick = 8 ) {
+			const size_t* dims = lattice.dims;
+			std::vector< size_t > order;
+			order.reserve( lattice.size() );
+			for( size_t bk=0; bk<dims[2]; bk+=brick ) {
+				for( size_t bj=0; bj<dims[1]; bj+=brick ) {
+					for( size_t bi=0; bi<dims[0]; bi+=brick ) {
+						for( size_t k=bk; k<std::min( bk + brick, dims[2] ); k++ ) {
+							for( size_t j=bj; j<std::min( bj + brick, dims[1] ); j++ ) {
+								for( size_t i=bi; i<std::min( bi + brick, dims[0] ); i++ ) {
+									order.push_back( i + dims[0] * ( j + dims[1] * k ) );
+								}
+							}
+						}
+					}
+				}
+			}
+			return order;
+		}
+
+		namespace detail
+		{
+			// Number of equal steps covering time with at most stepSize each, and their signed size.
+			inline size_t timeSteps( double time, double stepSize, double& h ) {
+				const size_t steps = std::max< size_t >( size_t( std::ceil( std::abs( time ) / std::abs( stepSize ) - 1e-9 ) ), 1 );
+				h = time / double( steps );
+				return steps;
+			}
+
+			// Largest eigenvalue of the symmetric matrix c, in closed form.
+			inline double largestEigenvalue( const double c[3][3] ) {
+				const double off = c[0][1] * c[0][1] + c[0][2] * c[0][2] + c[1][2] * c[1][2];
+				const double q = ( c[0][0] + c[1][1] + c[2][2] ) / 3.0;
+				const double a = c[0][0] - q, b = c[1][1] - q, d = c[2][2] - q;
+				const double p = std::sqrt( ( a * a + b * b + d * d + 2.0 * off ) / 6.0 );
+				if( !( p > 0.0 ) ) return q;
+				// half the determinant of ( c - q ) / p is the cosine of three times the angle
+				const double det = a * ( b * d - c[1][2] * c[1][2] ) - c[0][1] * ( c[0][1] * d - c[1][2] * c[0][2] ) + c[0][2] * ( c[0][1] * c[1][2] - b * c[0][2] );
+				const double r = std::min( std::max( det / ( 2.0 * p * p * p ), -1.0 ), 1.0 );
+				return q + 2.0 * p * std::cos( std::acos( r ) / 3.0 );
+			}
+		}
+
+		/// Advects a particle from every node of lattice for time, negative for backward, with RK4
+		/// in equal steps of at most stepSize. The end positions go into flowMap, x y z of node i at
+		/// 3 * i. A particle that leaves the field stops at its last position inside, one starting
+		/// outside stays where it is. The particles go through integrateLines in brickOrder;
+		/// makeField and progress are those of integrateLines. Returns the number of steps.
+		template< typename V, typename MakeField, typename Progress >
+		inline size_t advectLattice( const Lattice& lattice, double time, double stepSize, AbortFlag abortFlag,
+									 MakeField makeField, Progress progress, std::vector< double >& flowMap ) {
+			const std::vector< size_t > order = brickOrder( lattice );
+			std::vector< V > seeds( order.size() );
+			for( size_t i=0; i<order.size(); i++ ) {
+				seeds[i] = V{ lattice.coordinate( order[i], 0 ), lattice.coordinate( order[i], 1 ), lattice.coordinate( order[i], 2 ) };
+			}
+
+			// the ends in brick order as well, so that the sinks of a thread write close together
+			std::vector< double > ends( 3 * seeds.size() );
+			for( size_t i=0; i<seeds.size(); i++ ) {
+				for( size_t d=0; d<3; d++ ) ends[3*i+d] = seeds[i][d];
+			}
+			auto makeSink = [&ends]( size_t line, const V& ) {
+				double* end = &ends[ 3 * line ];
+				return [end]( const V& x ) {
+					for( size_t d=0; d<3; d++ ) end[d] = x[d];
+				};
+			};
+			double h;
+			const size_t steps = detail::timeSteps( time, stepSize, h );
+			const size_t total = integrateLines( RK4< V >( h ), false, seeds, steps, abortFlag, makeField, makeSink, progress );
+
+			flowMap.resize( ends.size() );
+			for( size_t i=0; i<order.size(); i++ ) {
+				for( size_t d=0; d<3; d++ ) flowMap[ 3 * order[i] + d ] = ends[3*i+d];
+			}
+			return total;
+		}
+
+		/// advectLattice on a uniform field with integratePacketsRK4, which advances a packet of
+		/// neighbouring particles per thread in SIMD lanes; progress is that of integratePacketsRK4.
+		/// Requires supportsPackets( field ).
+		template< typename Progress >
+		inline size_t advectLatticePackets( const Lattice& lattice, const StructuredVectorField& field, double time, double stepSize, AbortFlag abortFlag,
+											Progress progress, std::vector< double >& flowMap, PacketIsa isa = PacketIsa::Best ) {
+			const std::vector< size_t > order = brickOrder( lattice );
+			std::vector< double > seeds( 3 * order.size() );
+			for( size_t i=0; i<order.size(); i++ ) {
+				for( size_t d=0; d<3; d++ ) seeds[3*i+d] = lattice.coordinate( order[i], d );
+			}
+
+			// a particle is in one lane at a time, so its end is only written by one thread
+			std::vector< double > ends( seeds );
+			auto sink = [&ends]( size_t seed, const double x[3] ) {
+				for( size_t d=0; d<3; d++ ) ends[3*seed+d] = x[d];
+			};
+			double h;
+			const size_t steps = detail::timeSteps( time, stepSize, h );
+			const size_t total = integratePacketsRK4( field, seeds, h, steps, abortFlag, sink, progress, isa );
+
+			flowMap.resize( ends.size() );
+			for( size_t i=0; i<order.size(); i++ ) {
+				for( size_t d=0; d<3; d++ ) flowMap[ 3 * order[i] + d ] = ends[3*i+d];
+			}
+			return total;
+		}
+
+		/// Finite-time Lyapunov exponent of every node of lattice from the flow map over time, as
+		/// made by advectLattice: the logarithm of the largest stretching of the flow map gradient
+		/// divided by |time|. The gradient is taken with central differences between neighbouring
+		/// nodes, one-sided at the border; axes with a single node don't stretch.
+		inline void computeFtle( const Lattice& lattice, const std::vector< double >& flowMap, double time, std::vector< double >& ftle ) {
+			const size_t* dims = lattice.dims;
+			const size_t strides[3] = { 1, dims[0], dims[0] * dims[1] };
+			const double scale = 1.0 / ( 2.0 * std::abs( time ) );
+			ftle.resize( lattice.size() );
+
+			#pragma omp parallel for
+			for( long long n=0; n<(long long)lattice.size(); n++ ) {
+				// jacobian[a][d] is the derivative of end coordinate a along axis d
+				double jacobian[3][3];
+				for( size_t d=0; d<3; d++ ) {
+					const size_t c = size_t( n ) / strides[d] % dims[d];
+					if( dims[d] < 2 ) {
+						for( size_t a=0; a<3; a++ ) jacobian[a][d] = a == d ? 1.0 : 0.0;
+						continue;
+					}
+					const size_t lower = c > 0 ? size_t( n ) - strides[d] : size_t( n );
+					const size_t upper = c + 1 < dims[d] ? size_t( n ) + strides[d] : size_t( n );
+					const double distance = double( ( upper - lower ) / strides[d] ) * lattice.spacing[d];
+					for( size_t a=0; a<3; a++ ) jacobian[a][d] = ( flowMap[3*upper+a] - flowMap[3*lower+a] ) / distance;
+				}
+
+				// Cauchy-Green tensor J^T J
+				double cauchyGreen[3][3];
+				for( size_t r=0; r<3; r++ ) {
+					for( size_t c=0; c<3; c++ ) {
+						cauchyGreen[r][c] = jacobian[0][r] * jacobian[0][c] + jacobian[1][r] * jacobian[1][c] + jacobian[2][r] * jacobian[2][c];
+					}
+				}
+				const double lambda = detail::largestEigenvalue( cauchyGreen );
+				ftle[n] = lambda > 0.0 ? scale * std::log( lambda ) : 0.0;
+			}
+		}
+	}
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fantom/datastructures/LineSet.hpp>
+
+#include "AbortFlag.hpp"
+#include "LineArena.hpp"
+#include "LRUCache.hpp"
+
+namespace fantom
+{
+
+	/// Process-wide cache of integrated streamlines, shared by all integrator algorithms.
+	///
+	/// A request names the field and an exact description of everything else the lines depend
+	/// on, e.g. the stepper and its step size. Single lines are cached per seed, so that a seed
+	/// set that differs only partly integrates just the new seeds. Complete LineSets are cached
+	/// per seed set, so an unchanged request returns its result at once. A field is identified by
+	/// its address while it is alive, fantom data objects are never changed after creation.
+	///
+	/// Three quarters of the budget hold lines, one quarter LineSets, both evicted LRU.
+	class IntegrationCache {
+
+	public:
+		struct Request {
+			std::shared_ptr< const void > field;
+			std::string parameters;
+		};
+
+		static IntegrationCache& instance() {
+			static IntegrationCache cache;
+			return cache;
+		}
+
+		/// Appends name and the exact bits of value to parameters.
+		static void describe( std::string& parameters, const char* name, double value ) {
+			char text[64];
+			std::snprintf( text, sizeof( text ), "%s=%a;", name, value );
+			parameters += text;
+		}
+
+		/// Sets the budget owner, e.g. an algorithm, asks for, 0 withdraws its request. The cache is
+		/// as large as the largest request, so a node that doesn't cache never evicts the lines of
+		/// the others. Owners withdraw their request when they are destroyed.
+		void requestBudget( const void* owner, size_t bytes ) {
+			std::lock_guard< std::mutex > lock( m_budgetMutex );
+			if( bytes > 0 ) m_budgets[owner] = bytes;
+			else m_budgets.erase( owner );
+			size_t budget = 0;
+			for( const auto& request : m_budgets ) budget = std::max( budget, request.second );
+			m_lines.setBudget( budget - budget / 4 );
+			m_results.setBudget( budget / 4 );
+		}
+
+		size_t memoryUsed() const {
+			return m_lines.used() + m_results.used();
+		}
+
+		/// Line from seed, the seed included, or nullptr.
+		std::shared_ptr< const std::vector< Point3 > > line( const Request& request, const Point3& seed ) {
+			std::shared_ptr< const CachedLine > cached = m_lines.get( LineKey( request, seed ) );
+			if( !cached || !sameField( cached->field, request ) ) return nullptr;
+			return std::shared_ptr< const std::vector< Point3 > >( cached, &cached->vertices );
+		}
+
+		void putLine( const Request& request, const Point3& seed, std::vector< Point3 > vertices ) {
+			size_t bytes = sizeof( CachedLine ) + request.parameters.size() + vertices.size() * sizeof( Point3 );
+			m_lines.put( LineKey( request, seed ), std::make_shared< const CachedLine >( CachedLine{ request.field, std::move( vertices ) } ), bytes );
+		}
+
+		/// LineSet of all seeds, or nullptr.
+		std::shared_ptr< const LineSet > result( const Request& request, const std::vector< Point3 >& seeds ) {
+			std::shared_ptr< const CachedResult > cached = m_results.get( ResultKey( request, seeds ) );
+			if( !cached || !sameField( cached->field, request ) || !sameSeeds( cached->seeds, seeds ) ) return nullptr;
+			return cached->lines;
+		}
+
+		/// numVertices is the size of lines, which LineSet doesn't report.
+		void putResult( const Request& request, const std::vector< Point3 >& seeds, std::shared_ptr< const LineSet > lines, size_t numVertices ) {
+			size_t bytes = sizeof( CachedResult ) + seeds.size() * sizeof( Point3 ) + numVertices * ( sizeof( Point3 ) + sizeof( size_t ) );
+			m_results.put( ResultKey( request, seeds ), std::make_shared< const CachedResult >( CachedResult{ request.field, seeds, std::move( lines ) } ), bytes );
+		}
+
+	private:
+		struct CachedLine {
+			std::weak_ptr< const void > field;
+			std::vector< Point3 > vertices;
+		};
+
+		struct CachedResult {
+			std::weak_ptr< const void > field;
+			std::vector< Point3 > seeds;
+			std::shared_ptr< const LineSet > lines;
+		};
+
+		static uint64_t bits( double value ) {
+			uint64_t b;
+			std::memcpy( &b, &value, sizeof( b ) );
+			return b;
+		}
+
+		static size_t mix( size_t hash, uint64_t value ) {
+			return hash ^ ( std::hash< uint64_t >()( value ) + 0x9e3779b97f4a7c15ull + ( hash << 6 ) + ( hash >> 2 ) );
+		}
+
+		struct LineKey {
+			const void* field;
+			std::string parameters;
+			uint64_t seed[3];
+
+			LineKey( const Request& request, const Point3& p ) :
+				field( request.field.get() ),
+				parameters( request.parameters ),
+				seed{ bits( p[0] ), bits( p[1] ), bits( p[2] ) }
+			{
+
+			}
+
+			bool operator==( const LineKey& other ) const {
+				return field == other.field && seed[0] == other.seed[0] && seed[1] == other.seed[1] && seed[2] == other.seed[2] && parameters == other.parameters;
+			}
+		};
+
+		struct LineKeyHash {
+			size_t operator()( const LineKey& key ) const {
+				size_t hash = mix( std::hash< std::string >()( key.parameters ), uint64_t( key.field ) );
+				for( size_t d=0; d<3; d++ ) hash = mix( hash, key.seed[d] );
+				return hash;
+			}
+		};
+
+		// The seeds themselves are compared in result().
+		struct ResultKey {
+			const void* field;
+			std::string parameters;
+			uint64_t seedHash;
+			size_t numSeeds;
+
+			ResultKey( const Request& request, const std::vector< Point3 >& seeds ) :
+				field( request.field.get() ),
+				parameters( request.parameters ),
+				seedHash( 0 ),
+				numSeeds( seeds.size() )
+			{
+				for( const Point3& p : seeds ) {
+					for( size_t d=0; d<3; d++ ) seedHash = mix( seedHash, bits( p[d] ) );
+				}
+			}
+
+			bool operator==( const ResultKey& other ) const {
+				return field == other.field && seedHash == other.seedHash && numSeeds == other.numSeeds && parameters == other.parameters;
+			}
+		};
+
+		struct ResultKeyHash {
+			size_t operator()( const ResultKey& key ) const {
+				return mix( mix( std::hash< std::string >()( key.parameters ), uint64_t( key.field ) ), key.seedHash );
+			}
+		};
+
+		LRUCache< LineKey, CachedLine, LineKeyHash > m_lines;
+		LRUCache< ResultKey, CachedResult, ResultKeyHash > m_results;
+		std::mutex m_budgetMutex;
+		std::map< const void*, size_t > m_budgets;
+
+		IntegrationCache() :
+			m_lines( 0 ),
+			m_results( 0 )
+		{
+
+		}
+
+		// The address of a field that has been freed may be taken by a new one.
+		static bool sameField( const std::weak_ptr< const void >& cached, const Request& request ) {
+			std::shared_ptr< const void > field = cached.lock();
+			return field && field == request.field;
+		}
+
+		static bool sameSeeds( const std::vector< Point3 >& a, const std::vector< Point3 >& b ) {
+			if( a.size() != b.size() ) return false;
+			for( size_t i=0; i<a.size(); i++ ) {
+				for( size_t d=0; d<3; d++ ) {
+					if( bits( a[i][d] ) != bits( b[i][d] ) ) return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	/// Fills vertices and offsets with a line from every seed, line i from offsets[i] to
+	/// offsets[i+1] beginning with seed i. With useCache set lines of earlier runs of request are
+	/// taken from the cache, and the new lines are cached unless abortFlag cut them short.
+	/// integrateMissing( seeds, arena ) integrates the others into arena, which holds seed j as
+	/// the start of line j. Returns the number of lines taken from the cache.
+	template< typename IntegrateMissing >
+	inline size_t integrateWithCache( const IntegrationCache::Request& request, const std::vector< Point3 >& seeds, bool useCache, AbortFlag abortFlag,
+									  IntegrateMissing integrateMissing, std::vector< Point3 >& vertices, std::vector< size_t >& offsets ) {
+		IntegrationCache& cache = IntegrationCache::instance();
+		std::vector< std::shared_ptr< const std::vector< Point3 > > > cached( seeds.size() );
+		std::vector< Point3 > missing;
+		for( size_t i=0; i<seeds.size(); i++ ) {
+			if( useCache ) cached[i] = cache.line( request, seeds[i] );
+			if( !cached[i] ) missing.push_back( seeds[i] );
+		}
+
+		LineArena< Point3 > arena( missing.size() );
+		for( size_t j=0; j<missing.size(); j++ ) {
+			arena.push( j, missing[j] );
+		}
+		if( !missing.empty() ) integrateMissing( missing, arena );
+		std::vector< Point3 > integrated;
+		std::vector< size_t > integratedOffsets;
+		arena.merge( integrated, integratedOffsets );
+
+		if( useCache && !( abortFlag && *abortFlag ) ) {
+			for( size_t j=0; j<missing.size(); j++ ) {
+				cache.putLine( request, missing[j], std::vector< Point3 >( integrated.begin() + integratedOffsets[j], integrated.begin() + integratedOffsets[j+1] ) );
+			}
+		}
+
+		if( missing.size() == seeds.size() ) {
+			vertices.swap( integrated );
+			offsets.swap( integratedOffsets );
+			return 0;
+		}
+		offsets.assign( seeds.size() + 1, 0 );
+		for( size_t i=0, j=0; i<seeds.size(); i++ ) {
+			offsets[i+1] = offsets[i] + ( cached[i] ? cached[i]->size() : integratedOffsets[j+1] - integratedOffsets[j] );
+			if( !cached[i] ) j++;
+		}
+		vertices.resize( offsets[seeds.size()] );
+		for( size_t i=0, j=0; i<seeds.size(); i++ ) {
+			if( cached[i] ) {
+				std::copy( cached[i]->begin(), cached[i]->end(), vertices.begin() + offsets[i] );
+			} else {
+				std::copy( integrated.begin() + integratedOffsets[j], integrated.begin() + integratedOffsets[j+1], vertices.begin() + offsets[i] );
+				j++;
+			}
+		}
+		return seeds.size() - missing.size();
+	}
+}
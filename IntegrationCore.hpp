@@ -0,0 +1,415 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <string>
+
+#include "AbortFlag.hpp"
+
+namespace fantom
+{
+
+	/// Building blocks of the line integrators. Everything is a template parameter, so every
+	/// combination of stepper, field, termination and sink compiles into its own loop without
+	/// virtual calls inside the integration itself.
+	///
+	/// The vector type V only needs +, -, scalar * and the free functions norm() and
+	/// normalized(), so fantom tensors and plain structs in benchmarks both work.
+	///
+	/// A field is a callable bool( const V& x, V& v ) that stores the velocity at x in v and
+	/// returns false outside of its domain. A termination policy is a callable bool( const V& x )
+	/// that is asked after every step whether the line ends at x. A sink is a callable
+	/// void( const V& x ) that receives every new position.
+	namespace integration
+	{
+
+		/// Explicit Euler, first order.
+		template< typename V >
+		class Euler {
+
+		public:
+			static const size_t evaluations = 1;
+
+			Euler( double stepSize ) :
+				m_stepSize( stepSize )
+			{
+
+			}
+
+			template< typename Field >
+			bool step( Field& field, V& x ) {
+				V k1;
+				if( !field( x, k1 ) ) return false;
+				x = x + m_stepSize * k1;
+				return true;
+			}
+
+			double stepSize() const {
+				return m_stepSize;
+			}
+
+		private:
+			double m_stepSize;
+		};
+
+		/// Heun's method, explicit trapezoidal rule, second order.
+		template< typename V >
+		class Heun {
+
+		public:
+			static const size_t evaluations = 2;
+
+			Heun( double stepSize ) :
+				m_stepSize( stepSize )
+			{
+
+			}
+
+			template< typename Field >
+			bool step( Field& field, V& x ) {
+				V k1, k2;
+				if( !field( x, k1 ) ) return false;
+				if( !field( x + m_stepSize * k1, k2 ) ) return false;
+				x = x + ( m_stepSize / 2 ) * ( k1 + k2 );
+				return true;
+			}
+
+			double stepSize() const {
+				return m_stepSize;
+			}
+
+		private:
+			double m_stepSize;
+		};
+
+		/// Classic fourth order Runge-Kutta.
+		template< typename V >
+		class RK4 {
+
+		public:
+			static const size_t evaluations = 4;
+
+			RK4( double stepSize ) :
+				m_stepSize( stepSize )
+			{
+
+			}
+
+			template< typename Field >
+			bool step( Field& field, V& x ) {
+				V k1, k2, k3, k4;
+				if( !field( x, k1 ) ) return false;
+				if( !field( x + ( m_stepSize / 2 ) * k1, k2 ) ) return false;
+				if( !field( x + ( m_stepSize / 2 ) * k2, k3 ) ) return false;
+				if( !field( x + m_stepSize * k3, k4 ) ) return false;
+				x = x + ( m_stepSize / 6 ) * ( k1 + 2 * k2 + 2 * k3 + k4 );
+				return true;
+			}
+
+			double stepSize() const {
+				return m_stepSize;
+			}
+
+		private:
+			double m_stepSize;
+		};
+
+		/// Dormand-Prince 5(4) with a fixed step, advancing with the fifth order solution.
+		template< typename V >
+		class RK45 {
+
+		public:
+			static const size_t evaluations = 6;
+
+			RK45( double stepSize ) :
+				m_stepSize( stepSize )
+			{
+
+			}
+
+			template< typename Field >
+			bool step( Field& field, V& x ) {
+				const double h = m_stepSize;
+				V k1, k2, k3, k4, k5, k6;
+				if( !field( x, k1 ) ) return false;
+				if( !field( x + h * ( 1.0 / 5 ) * k1, k2 ) ) return false;
+				if( !field( x + h * ( ( 3.0 / 40 ) * k1 + ( 9.0 / 40 ) * k2 ), k3 ) ) return false;
+				if( !field( x + h * ( ( 44.0 / 45 ) * k1 - ( 56.0 / 15 ) * k2 + ( 32.0 / 9 ) * k3 ), k4 ) ) return false;
+				if( !field( x + h * ( ( 19372.0 / 6561 ) * k1 - ( 25360.0 / 2187 ) * k2 + ( 64448.0 / 6561 ) * k3 - ( 212.0 / 729 ) * k4 ), k5 ) ) return false;
+				if( !field( x + h * ( ( 9017.0 / 3168 ) * k1 - ( 355.0 / 33 ) * k2 + ( 46732.0 / 5247 ) * k3 + ( 49.0 / 176 ) * k4 - ( 5103.0 / 18656 ) * k5 ), k6 ) ) return false;
+				x = x + h * ( ( 35.0 / 384 ) * k1 + ( 500.0 / 1113 ) * k3 + ( 125.0 / 192 ) * k4 - ( 2187.0 / 6784 ) * k5 + ( 11.0 / 84 ) * k6 );
+				return true;
+			}
+
+			double stepSize() const {
+				return m_stepSize;
+			}
+
+		private:
+			double m_stepSize;
+		};
+
+		/// Error control of adaptive steppers. A step is accepted if the norm of its error estimate
+		/// is at most absolute + relative * |x|, or if it is already as small as minStep.
+		struct Tolerance {
+			double absolute = 1e-6;
+			double relative = 1e-6;
+			double minStep = 1e-6;
+			double maxStep = std::numeric_limits< double >::infinity();
+		};
+
+		/// Dormand-Prince 5(4) with error control. Every line keeps its own step size, so copy
+		/// the stepper per line. The last stage of an accepted step is the first stage of the next
+		/// one (FSAL), so an accepted step costs six evaluations. A stage outside the domain
+		/// shrinks the step, which lets lines end close to the boundary.
+		template< typename V >
+		class AdaptiveRK45 {
+
+		public:
+			static const size_t evaluations = 6;
+
+			AdaptiveRK45( double stepSize, const Tolerance& tolerance = Tolerance() ) :
+				m_tolerance( tolerance ),
+				m_stepSize( clampStep( stepSize ) ),
+				m_time( 0.0 ),
+				m_duration( std::numeric_limits< double >::infinity() ),
+				m_rejected( 0 ),
+				m_haveK1( false )
+			{
+
+			}
+
+			template< typename Field >
+			bool step( Field& field, V& x ) {
+				if( m_time >= m_duration ) return false;
+				if( !m_haveK1 ) {
+					if( !field( x, m_k1 ) ) return false;
+					m_haveK1 = true;
+				}
+
+				for( ;; ) {
+					// don't step past the end of the integration time
+					const double h = std::min( m_stepSize, m_duration - m_time );
+					const V& k1 = m_k1;
+					V k2, k3, k4, k5, k6, k7, y;
+					bool inside =
+						field( x + h * ( 1.0 / 5 ) * k1, k2 ) &&
+						field( x + h * ( ( 3.0 / 40 ) * k1 + ( 9.0 / 40 ) * k2 ), k3 ) &&
+						field( x + h * ( ( 44.0 / 45 ) * k1 - ( 56.0 / 15 ) * k2 + ( 32.0 / 9 ) * k3 ), k4 ) &&
+						field( x + h * ( ( 19372.0 / 6561 ) * k1 - ( 25360.0 / 2187 ) * k2 + ( 64448.0 / 6561 ) * k3 - ( 212.0 / 729 ) * k4 ), k5 ) &&
+						field( x + h * ( ( 9017.0 / 3168 ) * k1 - ( 355.0 / 33 ) * k2 + ( 46732.0 / 5247 ) * k3 + ( 49.0 / 176 ) * k4 - ( 5103.0 / 18656 ) * k5 ), k6 );
+					if( inside ) {
+						y = x + h * ( ( 35.0 / 384 ) * k1 + ( 500.0 / 1113 ) * k3 + ( 125.0 / 192 ) * k4 - ( 2187.0 / 6784 ) * k5 + ( 11.0 / 84 ) * k6 );
+						inside = field( y, k7 );
+					}
+					if( !inside ) {
+						// approach the boundary of the domain with smaller steps
+						if( !( h > m_tolerance.minStep ) ) return false;
+						m_stepSize = clampStep( h / 4 );
+						m_rejected++;
+						continue;
+					}
+
+					// difference between the fifth and the embedded fourth order solution
+					V error = h * ( ( 71.0 / 57600 ) * k1 - ( 71.0 / 16695 ) * k3 + ( 71.0 / 1920 ) * k4 - ( 17253.0 / 339200 ) * k5 + ( 22.0 / 525 ) * k6 - ( 1.0 / 40 ) * k7 );
+					double scale = m_tolerance.absolute + m_tolerance.relative * std::max( norm( x ), norm( y ) );
+					double ratio = norm( error ) / scale;
+					if( std::isnan( ratio ) ) return false;
+					double factor = ratio > 0.0 ? std::min( std::max( 0.9 * std::pow( ratio, -0.2 ), 0.2 ), 5.0 ) : 5.0;
+
+					if( ratio <= 1.0 || h <= m_tolerance.minStep ) {
+						x = y;
+						m_k1 = k7;
+						m_time += h;
+						m_stepSize = clampStep( std::max( h, m_stepSize ) * factor );
+						return true;
+					}
+					m_stepSize = clampStep( h * factor );
+					m_rejected++;
+				}
+			}
+
+			/// Step size proposed for the next step.
+			double stepSize() const {
+				return m_stepSize;
+			}
+
+			/// Integration time covered so far.
+			double time() const {
+				return m_time;
+			}
+
+			/// Ends the line after the given integration time, the last step is shortened to hit it.
+			void setDuration( double duration ) {
+				m_duration = duration;
+			}
+
+			/// Number of rejected step attempts.
+			size_t rejected() const {
+				return m_rejected;
+			}
+
+			/// Forgets the first stage, required if x is changed outside of step().
+			void restart() {
+				m_haveK1 = false;
+			}
+
+		private:
+			Tolerance m_tolerance;
+			double m_stepSize;
+			double m_time;
+			double m_duration;
+			size_t m_rejected;
+			bool m_haveK1;
+			V m_k1;
+
+			double clampStep( double h ) const {
+				return std::min( std::max( h, m_tolerance.minStep ), m_tolerance.maxStep );
+			}
+		};
+
+		/// Samples a field and scales the velocity to unit length, so that the step size becomes
+		/// the arc length of a step. Stagnation points end the line.
+		template< typename Field >
+		class Normalized {
+
+		public:
+			Normalized( Field& field ) :
+				m_field( field )
+			{
+
+			}
+
+			template< typename V >
+			bool operator()( const V& x, V& v ) {
+				if( !m_field( x, v ) ) return false;
+				double length = norm( v );
+				if( !( length > 0.0 ) ) return false;
+				v = ( 1.0 / length ) * v;
+				return true;
+			}
+
+		private:
+			Field& m_field;
+		};
+
+		/// Ends a line after a maximum number of steps or as soon as abortFlag is set.
+		class StepLimit {
+
+		public:
+			StepLimit( size_t maxSteps, AbortFlag abortFlag = nullptr ) :
+				m_maxSteps( maxSteps ),
+				m_steps( 0 ),
+				m_abortFlag( abortFlag )
+			{
+
+			}
+
+			template< typename V >
+			bool operator()( const V& ) {
+				return ++m_steps >= m_maxSteps || ( m_abortFlag && *m_abortFlag );
+			}
+
+			size_t steps() const {
+				return m_steps;
+			}
+
+		private:
+			size_t m_maxSteps;
+			size_t m_steps;
+			AbortFlag m_abortFlag;
+		};
+
+		/// Ends a line where terminate does, but also interrupts it after sliceSteps steps, so
+		/// the rest can be integrated later by continuing from the position and the stepper.
+		template< typename Termination >
+		class Slice {
+
+		public:
+			Slice( Termination& terminate, size_t sliceSteps ) :
+				m_terminate( terminate ),
+				m_sliceSteps( sliceSteps ),
+				m_steps( 0 ),
+				m_ended( false )
+			{
+
+			}
+
+			template< typename V >
+			bool operator()( const V& x ) {
+				if( m_terminate( x ) ) {
+					m_ended = true;
+					return true;
+				}
+				return ++m_steps >= m_sliceSteps;
+			}
+
+			/// Whether the slice stopped the line before terminate or the field ended it.
+			bool interrupted() const {
+				return !m_ended && m_steps >= m_sliceSteps;
+			}
+
+		private:
+			Termination& m_terminate;
+			size_t m_sliceSteps;
+			size_t m_steps;
+			bool m_ended;
+		};
+
+		/// Integrates one line starting at x until the field can't be evaluated any more or
+		/// terminate ends it. Every new position is passed to sink, the start itself is not, so
+		/// that an interrupted line can be continued from x. Returns the number of steps.
+		template< typename Stepper, typename Field, typename Termination, typename Sink, typename V >
+		inline size_t integrateLine( Stepper& stepper, Field& field, V& x, Termination& terminate, Sink& sink ) {
+			size_t steps = 0;
+			for( ;; ) {
+				if( !stepper.step( field, x ) ) break;
+				sink( x );
+				steps++;
+				if( terminate( x ) ) break;
+			}
+			return steps;
+		}
+
+		/// Steppers selectable at runtime.
+		enum class Method {
+			Euler,
+			Heun,
+			RK4,
+			RK45
+		};
+
+		/// Parses the option names used by the integrator algorithms.
+		inline bool parseMethod( const std::string& name, Method& method ) {
+			if( name == "Euler" ) method = Method::Euler;
+			else if( name == "Heun" ) method = Method::Heun;
+			else if( name == "Runge-Kutta" || name == "RK4" ) method = Method::RK4;
+			else if( name == "RK45" || name == "Dormand-Prince" ) method = Method::RK45;
+			else return false;
+			return true;
+		}
+
+		/// Calls function with a stepper of the given method, e.g. a generic lambda, so that the
+		/// whole integration loop inside is compiled once per stepper. RK45 adapts its step size
+		/// within tolerance, all other methods use a fixed step.
+		template< typename V, typename Function >
+		inline void withStepper( Method method, double stepSize, const Tolerance& tolerance, Function function ) {
+			switch( method ) {
+			case Method::Euler:
+				function( Euler< V >( stepSize ) );
+				break;
+			case Method::Heun:
+				function( Heun< V >( stepSize ) );
+				break;
+			case Method::RK4:
+				function( RK4< V >( stepSize ) );
+				break;
+			case Method::RK45:
+				function( AdaptiveRK45< V >( stepSize, tolerance ) );
+				break;
+			}
+		}
+	}
+}
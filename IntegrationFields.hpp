@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <fantom/fields.hpp>
+
+#include "IntegrationCore.hpp"
+#include "StructuredGrid.hpp"
+
+namespace fantom
+{
+
+	/// Field for the integration core that samples a fantom vector field through one evaluator.
+	/// Evaluators are not thread-safe, so every thread needs its own instance.
+	class EvaluatorField {
+
+	public:
+		EvaluatorField( const TensorFieldInterpolated< 3, Vector3 >& field ) :
+			m_evaluator( field.makeEvaluator() )
+		{
+
+		}
+
+		bool operator()( const Point3& x, Vector3& v ) {
+			if( !m_evaluator->reset( x ) ) return false;
+			v = m_evaluator->value();
+			return true;
+		}
+
+	private:
+		std::unique_ptr< TensorFieldInterpolated< 3, Vector3 >::Evaluator > m_evaluator;
+	};
+
+	/// Recovers the lattice of a grid whose hexahedra form nx x ny x nz points, as built by the
+	/// VTK loaders, from the vertex indices of its cells. Returns nullptr for other grids.
+	inline std::shared_ptr< const StructuredGrid > makeStructuredGrid( const Grid< 3 >& grid ) {
+		const ValueArray< Point3 >& points = grid.points();
+		const size_t numPoints = points.size();
+		if( grid.numCells() == 0 ) return nullptr;
+
+		// the first cell spans the points 0, 1, nx, nx+1, nx*ny, ...
+		Cell first = grid.cell( 0 );
+		if( first.numVertices() != 8 ) return nullptr;
+		size_t vertices[8];
+		for( size_t v=0; v<8; v++ ) vertices[v] = first.index( v );
+		std::sort( vertices, vertices + 8 );
+		if( vertices[0] != 0 || vertices[1] != 1 || vertices[2] < 2 || vertices[4] % vertices[2] != 0 ) return nullptr;
+
+		size_t dims[3] = { vertices[2], vertices[4] / vertices[2], 0 };
+		if( dims[1] < 2 || numPoints % vertices[4] != 0 ) return nullptr;
+		dims[2] = numPoints / vertices[4];
+		if( dims[2] < 2 || grid.numCells() != ( dims[0] - 1 ) * ( dims[1] - 1 ) * ( dims[2] - 1 ) ) return nullptr;
+
+		std::vector< double > coordinates[3];
+		for( size_t d=0; d<3; d++ ) coordinates[d].resize( numPoints );
+		#pragma omp parallel for
+		for( long long i=0; i<(long long)numPoints; i++ ) {
+			Point3 p = points[i];
+			for( size_t d=0; d<3; d++ ) coordinates[d][i] = p[d];
+		}
+		return std::make_shared< const StructuredGrid >( dims, std::move( coordinates[0] ), std::move( coordinates[1] ), std::move( coordinates[2] ) );
+	}
+
+	/// Lattice of grid as made by makeStructuredGrid. It is built on first use and shared by all
+	/// algorithms for as long as grid lives.
+	inline std::shared_ptr< const StructuredGrid > structuredGrid( const std::shared_ptr< const Grid< 3 > >& grid ) {
+		static std::mutex mutex;
+		static std::map< const Grid< 3 >*, std::pair< std::weak_ptr< const Grid< 3 > >, std::shared_ptr< const StructuredGrid > > > cache;
+
+		if( !grid ) return nullptr;
+		std::lock_guard< std::mutex > lock( mutex );
+		for( auto it = cache.begin(); it != cache.end(); ) {
+			if( it->second.first.expired() ) it = cache.erase( it );
+			else ++it;
+		}
+		auto cached = cache.find( grid.get() );
+		if( cached != cache.end() ) return cached->second.second;
+
+		// grids without a lattice are remembered as well, so they aren't inspected again
+		std::shared_ptr< const StructuredGrid > structured = makeStructuredGrid( *grid );
+		cache[ grid.get() ] = std::make_pair( std::weak_ptr< const Grid< 3 > >( grid ), structured );
+		return structured;
+	}
+
+	/// Whether p lies inside grid. Structured grids answer from their cached lattice.
+	inline bool insideGrid( const std::shared_ptr< const Grid< 3 > >& grid, const Point3& p ) {
+		std::shared_ptr< const StructuredGrid > structured = structuredGrid( grid );
+		if( !structured ) return grid->index( grid->locate( p ) ) != 0;
+
+		const double x[3] = { p[0], p[1], p[2] };
+		size_t cell = StructuredGrid::none;
+		double local[3];
+		return structured->locate( x, cell, local );
+	}
+
+	namespace detail
+	{
+		// Copies the values of field into the component arrays values in parallel, one discrete
+		// evaluator per thread. With T = float the copy stops and returns false as soon as a value
+		// doesn't survive the round trip through float.
+		template< typename T >
+		inline bool copyComponents( const TensorFieldInterpolated< 3, Vector3 >& field, size_t numPoints, std::vector< T > values[3] ) {
+			for( size_t d=0; d<3; d++ ) values[d].resize( numPoints );
+			std::atomic< bool > exact( true );
+			#pragma omp parallel
+			{
+				auto evaluator = field.makeDiscreteEvaluator();
+				#pragma omp for schedule( static, 4096 )
+				for( long long i=0; i<(long long)numPoints; i++ ) {
+					if( !exact.load( std::memory_order_relaxed ) ) continue;
+					Vector3 value = evaluator->value( i );
+					for( size_t d=0; d<3; d++ ) {
+						values[d][i] = T( value[d] );
+						if( double( values[d][i] ) != value[d] ) exact.store( false, std::memory_order_relaxed );
+					}
+				}
+			}
+			return exact;
+		}
+	}
+
+	/// Copies a vector field given at the points of a structured grid into the component arrays
+	/// of a StructuredVectorField for HintedField and the packets. Values that all survive a round
+	/// trip through float, as those of fields loaded in single precision do, stay single
+	/// precision. Returns nullptr if the grid isn't structured. Use structuredVectorField to
+	/// share the copy.
+	inline std::shared_ptr< const StructuredVectorField > makeStructuredVectorField( const TensorFieldInterpolated< 3, Vector3 >& field ) {
+		std::shared_ptr< const StructuredGrid > structured = structuredGrid( std::dynamic_pointer_cast< const Grid< 3 > >( field.domain() ) );
+		if( !structured || field.makeDiscreteEvaluator()->numValues() != structured->numPoints() ) return nullptr;
+
+		std::vector< float > floats[3];
+		if( detail::copyComponents( field, structured->numPoints(), floats ) ) return std::make_shared< const StructuredVectorField >( structured, floats );
+		for( size_t d=0; d<3; d++ ) std::vector< float >().swap( floats[d] );
+		std::vector< double > values[3];
+		detail::copyComponents( field, structured->numPoints(), values );
+		return std::make_shared< const StructuredVectorField >( structured, values );
+	}
+
+	/// makeStructuredVectorField of field, built on first use and shared by all algorithms for as
+	/// long as field lives, like structuredGrid. Fields are built outside of the lock, so that
+	/// different ones can be copied at the same time.
+	inline std::shared_ptr< const StructuredVectorField > structuredVectorField( const std::shared_ptr< const TensorFieldInterpolated< 3, Vector3 > >& field ) {
+		using Entry = std::pair< std::weak_ptr< const TensorFieldInterpolated< 3, Vector3 > >, std::shared_ptr< const StructuredVectorField > >;
+		static std::mutex mutex;
+		static std::map< const TensorFieldInterpolated< 3, Vector3 >*, Entry > cache;
+
+		if( !field ) return nullptr;
+		{
+			std::lock_guard< std::mutex > lock( mutex );
+			for( auto it = cache.begin(); it != cache.end(); ) {
+				if( it->second.first.expired() ) it = cache.erase( it );
+				else ++it;
+			}
+			auto cached = cache.find( field.get() );
+			if( cached != cache.end() ) return cached->second.second;
+		}
+
+		// fields without a lattice are remembered as well; if two threads built the same field,
+		// the first copy wins
+		std::shared_ptr< const StructuredVectorField > structured = makeStructuredVectorField( *field );
+		std::lock_guard< std::mutex > lock( mutex );
+		auto inserted = cache.emplace( field.get(), Entry( field, structured ) );
+		return inserted.first->second.second;
+	}
+
+	/// Field for the integration core on structured grids. The cell of the last evaluation is the
+	/// starting point of the next location, which usually finds the new cell after walking at most
+	/// one face. Only when walking fails the grid's cell locator is asked. One instance per thread.
+	class HintedField {
+
+	public:
+		HintedField( const StructuredVectorField& field ) :
+			m_field( field ),
+			m_hint( StructuredGrid::none ),
+			m_cell()
+		{
+
+		}
+
+		bool operator()( const Point3& x, Vector3& v ) {
+			const double p[3] = { x[0], x[1], x[2] };
+			double local[3];
+			if( !m_field.grid().locate( p, m_hint, m_cell, local ) ) return false;
+			v = m_field.interpolate< Vector3 >( m_cell, local );
+			return true;
+		}
+
+	private:
+		const StructuredVectorField& m_field;
+		size_t m_hint;
+		size_t m_cell[3];
+	};
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include <omp.h>
+
+#include "IntegrationCore.hpp"
+#include "TaskPool.hpp"
+
+namespace fantom
+{
+	namespace integration
+	{
+
+		/// Integrates a line from every seed with copies of stepper on a TaskPool over the threads
+		/// of a parallel region. Lines advance in slices of sliceSteps steps and the rest of a line
+		/// is queued as a continuation, so a few long lines don't keep the short ones from
+		/// starting, and idle threads steal the continuations. Continuing is exact: the stepper
+		/// keeps its state, e.g. the step size of RK45.
+		///
+		/// makeField() creates the field of one thread, with normalize set it's sampled through
+		/// Normalized. makeSink( line, x ) creates the sink receiving the positions of line after x,
+		/// once per slice. progress( finished, total ) is called by one thread about twice a second.
+		/// Lines end early once abortFlag is set. Returns the number of steps.
+		template< typename Stepper, typename V, typename MakeField, typename MakeSink, typename Progress >
+		inline size_t integrateLines( const Stepper& stepper, bool normalize, const std::vector< V >& seeds, size_t maxSteps,
+									  AbortFlag abortFlag, MakeField makeField, MakeSink makeSink, Progress progress,
+									  size_t sliceSteps = 256 ) {
+			struct LineTask {
+				size_t line;
+				V x;
+				Stepper stepper;
+				StepLimit limit;
+			};
+
+			std::vector< LineTask > tasks;
+			tasks.reserve( seeds.size() );
+			for( size_t i=0; i<seeds.size(); i++ ) {
+				tasks.push_back( LineTask{ i, seeds[i], stepper, StepLimit( maxSteps, abortFlag ) } );
+			}
+			const size_t numThreads = omp_get_max_threads();
+			TaskPool< LineTask > pool( numThreads, std::move( tasks ) );
+
+			size_t steps = 0;
+			#pragma omp parallel num_threads( numThreads ) reduction( + : steps )
+			{
+				auto field = makeField();
+				Normalized< decltype( field ) > direction( field );
+				const size_t thread = omp_get_thread_num();
+				auto reported = std::chrono::steady_clock::now();
+
+				while( std::optional< LineTask > task = pool.next( thread, abortFlag ) ) {
+					auto sink = makeSink( task->line, task->x );
+					Slice< StepLimit > slice( task->limit, sliceSteps );
+					if( normalize ) steps += integrateLine( task->stepper, direction, task->x, slice, sink );
+					else steps += integrateLine( task->stepper, field, task->x, slice, sink );
+
+					if( slice.interrupted() ) pool.resume( thread, std::move( *task ) );
+					else pool.finish();
+
+					if( thread == 0 && std::chrono::steady_clock::now() - reported > std::chrono::milliseconds( 500 ) ) {
+						progress( pool.finished(), pool.size() );
+						reported = std::chrono::steady_clock::now();
+					}
+				}
+			}
+			return steps;
+		}
+	}
+}
@@ -1,9 +1,20 @@
+#include <algorithm>
+#include <typeinfo>
+
 #include <fantom/algorithm.hpp>
 #include <fantom/register.hpp>
 #include <fantom/graphics.hpp>
 #include <fantom/fields.hpp>
 #include <fantom/datastructures/LineSet.hpp>
 
+#include "EvenlySpacedLines.hpp"
+#include "IntegrationCache.hpp"
+#include "IntegrationFields.hpp"
+#include "IntegrationTasks.hpp"
+#include "LineArena.hpp"
+#include "LineSets.hpp"
+#include "LineSimplification.hpp"
+
 using namespace fantom;
 
 namespace {
@@ -15,8 +26,20 @@ namespace {
 		std::shared_ptr< const Grid< 3 > > m_grid;
 		std::shared_ptr< const LineSet > m_seedLine;
 		size_t m_numPoints;
-		std::vector< std::vector< Point3 > > m_vertices;
+		std::vector< Point3 > m_vertices;	// all streamlines, line i from m_offsets[i] to m_offsets[i+1]
+		std::vector< size_t > m_offsets;
 		float m_stepSize;
+		size_t m_maxSteps;
+		double m_simplifyTolerance;
+		double m_separation;
+
+		// everything but the field and the seeds the streamlines depend on, for the cache
+		std::string m_parameters;
+		bool m_useCache;
+		IntegrationCache::Request m_request;
+		std::vector< Point3 > m_seeds;
+		bool m_complete;
+		std::shared_ptr< const LineSet > m_cachedResult;
 
 	public:
 		struct Options : public VisAlgorithm::Options {
@@ -26,6 +49,10 @@ namespace {
 				add< TensorFieldInterpolated< 3, Vector3 > >( "Field", "3D vector field" );
 				add< LineSet >( "Seed line", "Starting points" );
 				add< float >( "Step size", "Integration step size", 0.1 );
+				add< int >( "Max steps", "Maximum number of steps per streamline", 10000 );
+				add< float >( "Separation", "Distance kept between streamlines, more are seeded where there is room (Jobard-Lefer), 0 integrates one per seed", 0.0 );
+				add< float >( "Simplify tolerance", "Drop vertices closer than this to the simplified streamline, 0 keeps all", 0.0 );
+				add< int >( "Cache budget", "Memory for streamlines kept from earlier runs in MB, all integrators share the largest one set, 0 doesn't use the cache", 256 );
 			}
 		};
 
@@ -43,6 +70,10 @@ namespace {
 
 		}
 
+		~Integrator() {
+			IntegrationCache::instance().requestBudget( this, 0 );
+		}
+
 		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
 			m_field = options.get< TensorFieldInterpolated< 3, Vector3 > >( "Field" );
 			m_grid = std::dynamic_pointer_cast< const Grid< 3 > >( m_field->domain() );
@@ -57,22 +88,124 @@ namespace {
 				return;
 			}
 
-			for( int i=0; i<m_vertices.size(); i++ ) {
-				m_vertices[i].clear();
-			}
 			m_vertices.clear();
+			m_offsets.clear();
 			m_stepSize = options.get< float >( "Step size" );
+			m_maxSteps = std::max( options.get< int >( "Max steps" ), 1 );
+			m_simplifyTolerance = options.get< float >( "Simplify tolerance" );
+			m_separation = std::max( options.get< float >( "Separation" ), 0.0f );
+
+			m_parameters.clear();
+			IntegrationCache::describe( m_parameters, "step", m_stepSize );
+			IntegrationCache::describe( m_parameters, "max steps", m_maxSteps );
+			IntegrationCache::describe( m_parameters, "separation", m_separation );
+			size_t budget = size_t( std::max( options.get< int >( "Cache budget" ), 0 ) ) << 20;
+			m_useCache = budget > 0;
+			IntegrationCache::instance().requestBudget( this, budget );
+			m_cachedResult = nullptr;
+			m_complete = false;
+		}
+
+		// Integrates a streamline from every point of the seed line into m_vertices with copies of
+		// stepper. With normalize set the step size is measured in arc length.
+		template< typename Stepper >
+		void integrate( const Stepper& stepper, bool normalize, const volatile bool& abortFlag ) {
+			std::string method = typeid( Stepper ).name();
+			if( normalize ) method += " normalized";
+			if( m_separation > 0.0 ) {
+				integrateSpaced( method, stepper, normalize, abortFlag );
+				return;
+			}
+			integrateCached( method, abortFlag, [&]( const std::vector< Point3 >& seeds, LineArena< Point3 >& arena ) {
+				integrateSeeds( stepper, normalize, abortFlag, seeds, arena, structuredVectorField( m_field ) );
+			} );
+		}
+
+		// Fills m_vertices and m_offsets with a streamline from every point of the seed line. Lines
+		// of earlier runs with the same field, method and m_parameters are taken from the cache,
+		// integrateMissing( seeds, arena ) integrates the others into arena, seed i as line i after
+		// the seed itself. If the whole result is cached, m_cachedResult is set instead.
+		template< typename IntegrateMissing >
+		void integrateCached( const std::string& method, const volatile bool& abortFlag, IntegrateMissing integrateMissing ) {
+			if( lookupResult( method ) ) return;
+
+			// lines cut short by an abort are neither cached nor part of a cached result
+			size_t numCached = integrateWithCache( m_request, m_seeds, m_useCache, &abortFlag, integrateMissing, m_vertices, m_offsets );
+			if( m_useCache ) debugLog() << numCached << " of " << m_numPoints << " streamlines from the cache" << std::endl;
+			m_complete = !abortFlag;
+		}
+
+		// Evenly-spaced streamlines, the points of the seed line are tried first. Lines depend on
+		// each other, so only whole results are cached.
+		template< typename Stepper >
+		void integrateSpaced( const std::string& method, const Stepper& stepper, bool normalize, const volatile bool& abortFlag ) {
+			if( lookupResult( method ) ) return;
+
+			std::shared_ptr< const StructuredVectorField > structured = structuredVectorField( m_field );
+			integration::SpacingStats stats;
+			if( structured ) {
+				stats = integration::integrateEvenlySpaced( stepper, normalize, m_seeds, m_maxSteps, m_separation, &abortFlag, [&]() { return HintedField( *structured ); }, m_vertices, m_offsets );
+			} else {
+				stats = integration::integrateEvenlySpaced( stepper, normalize, m_seeds, m_maxSteps, m_separation, &abortFlag, [&]() { return EvaluatorField( *m_field ); }, m_vertices, m_offsets );
+			}
+			infoLog() << stats.lines << " streamlines from " << stats.candidates << " seeds in " << stats.steps << " steps" << std::endl;
+			m_complete = !abortFlag;
+		}
+
+		// Reads the seeds and the request of method, and returns whether its whole result is
+		// cached in m_cachedResult.
+		bool lookupResult( const std::string& method ) {
+			m_seeds.resize( m_numPoints );
+			for( size_t i=0; i<m_numPoints; i++ ) {
+				m_seeds[i] = m_seedLine->getPoint( i );
+			}
+
+			m_request.field = m_field;
+			m_request.parameters = method + ";" + m_parameters;
+			if( m_useCache ) m_cachedResult = IntegrationCache::instance().result( resultRequest(), m_seeds );
+			return m_cachedResult != nullptr;
+		}
+
+		// Integrates a line from every seed into arena with copies of stepper. Structured grids
+		// are sampled with the cell of the last step as location hint. Long lines are continued in
+		// slices on a work-stealing pool, which logs how many lines are done while it runs.
+		template< typename Stepper >
+		void integrateSeeds( const Stepper& stepper, bool normalize, const volatile bool& abortFlag, const std::vector< Point3 >& seeds,
+							 LineArena< Point3 >& arena, std::shared_ptr< const StructuredVectorField > structured ) {
+			auto makeSink = [&arena]( size_t i, const Point3& ) {
+				return [&arena, i]( const Point3& x ) { arena.push( i, x ); };
+			};
+			auto progress = [this]( size_t finished, size_t total ) {
+				debugLog() << "Integrated " << finished << " of " << total << " streamlines" << std::endl;
+			};
+			if( structured ) {
+				integration::integrateLines( stepper, normalize, seeds, m_maxSteps, &abortFlag, [&]() { return HintedField( *structured ); }, makeSink, progress );
+			} else {
+				integration::integrateLines( stepper, normalize, seeds, m_maxSteps, &abortFlag, [&]() { return EvaluatorField( *m_field ); }, makeSink, progress );
+			}
+		}
+
+		// The LineSet also depends on the simplification.
+		IntegrationCache::Request resultRequest() const {
+			IntegrationCache::Request request = m_request;
+			IntegrationCache::describe( request.parameters, "simplify", m_simplifyTolerance );
+			return request;
 		}
 
 		void makeLineSet( const Algorithm::Options& options ) {
-			std::shared_ptr< LineSet > streamlines( new LineSet );
-			for( int i=0; i<m_vertices.size(); i++ ) {
-				std::vector< size_t > indices;
-				for( int j=0; j<m_vertices[i].size(); j++ ) {
-					indices.push_back( streamlines->addPoint( m_vertices[i][j] ) );
-				}
-				streamlines->addLine( indices );
+			if( m_cachedResult ) {
+				debugLog() << "Streamlines from the cache" << std::endl;
+				setResult( "Streamlines", m_cachedResult );
+				return;
 			}
+
+			if( m_simplifyTolerance > 0.0 ) {
+				SimplifyStats stats = simplifyLines( m_vertices, m_offsets, m_simplifyTolerance );
+				infoLog() << "Simplified " << stats.inputVertices << " to " << stats.outputVertices << " vertices (" << stats.reduction() << "x), max deviation " << stats.maxDeviation << std::endl;
+			}
+
+			std::shared_ptr< LineSet > streamlines = fantom::makeLineSet( m_vertices, m_offsets );
+			if( m_useCache && m_complete ) IntegrationCache::instance().putResult( resultRequest(), m_seeds, streamlines, m_vertices.size() );
 			setResult( "Streamlines", streamlines );
 		}
 
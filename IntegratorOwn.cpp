@@ -1,8 +1,20 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+
 #include <fantom/algorithm.hpp>
 #include <fantom/register.hpp>
 #include <fantom/graphics.hpp>
 #include <fantom/fields.hpp>
 
+#include "EvenlySpacedLines.hpp"
+#include "IntegrationCache.hpp"
+#include "IntegrationFields.hpp"
+#include "IntegrationTasks.hpp"
+#include "LineArena.hpp"
+#include "LineSimplification.hpp"
+
 using namespace fantom;
 
 namespace {
@@ -20,20 +32,36 @@ namespace {
 		std::unique_ptr< Manipulator > m_manipulator2;
 		std::unique_ptr< Manipulator > m_manipulator3;
 
+		// Seed line ends, written by move() on the interaction thread while execute() may run.
+		std::mutex m_handleMutex;
 		Point3 p1;
 		Point3 p2;
 
 		bool euler;
 
+		// Set when a handle is dragged or fantom aborts, ends the lines of the running execute().
+		// Atomic, since move() sets it from the interaction thread while the lines read it.
+		std::atomic< bool > m_cancel{ false };
+
+		// The preview integrates every previewStride-th seed with previewStride times the step.
+		static const size_t previewStride = 4;
+
 	public:
 		struct Options : public VisAlgorithm::Options {
 			Options( fantom::Options::Control& control ) :
 				VisAlgorithm::Options( control )
 			{
 				add< TensorFieldInterpolated< 3, Vector3 > >( "Field", "3D vector field" );
-				add< InputChoices >( "Algorithm", "Choose an integration algorithm", std::vector< std::string >{ "Euler", "Runge-Kutta" }, "Euler" );
+				add< InputChoices >( "Algorithm", "Choose an integration algorithm", std::vector< std::string >{ "Euler", "Heun", "Runge-Kutta", "RK45" }, "Euler" );
 				add< int >( "Starting points", "Number of starting points", 20 );
 				add< float >( "Step size", "Integration step size", 0.1 );
+				add< int >( "Max steps", "Maximum number of steps per streamline", 10000 );
+				add< float >( "Absolute tolerance", "Allowed error per RK45 step", 1e-5 );
+				add< float >( "Relative tolerance", "Allowed error per RK45 step relative to the position", 1e-5 );
+				add< float >( "Separation", "Distance kept between streamlines, more are seeded where there is room (Jobard-Lefer), 0 integrates one per seed", 0.0 );
+				add< float >( "Simplify tolerance", "Drop vertices closer than this to the simplified streamline, 0 keeps all", 0.0 );
+				add< bool >( "Progressive", "Show a coarse preview of every few streamlines before the full result", true );
+				add< int >( "Cache budget", "Memory for streamlines kept from earlier runs in MB, all integrators share the largest one set, 0 doesn't use the cache", 256 );
 			}
 		};
 
@@ -81,104 +109,168 @@ namespace {
 			m_manipulator2->primitive().addSphere( Point3( 0.0, 0.0, 1.0 ), 0.05, Color( 1.0, 0.0, 0.0, 0.5 ) );
 		}
 
-		virtual void execute( const Algorithm::Options& options, const volatile bool& /*abortFlag*/ ) override {
+		~Integrator() {
+			IntegrationCache::instance().requestBudget( this, 0 );
+		}
+
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
+			m_cancel = false;
 			m_startingPoints = getGraphics( "startingPoints").makePrimitive();
 			m_streamLines = getGraphics( "streamlines" ).makePrimitive();
 
-			if( options.get< std::string >( "Algorithm" ) == "Euler" ) euler = true;
-			else euler = false;
+			integration::Method method;
+			if( !integration::parseMethod( options.get< std::string >( "Algorithm" ), method ) ) return;
+			euler = method == integration::Method::Euler;
 
 			auto field = options.get< TensorFieldInterpolated< 3, Vector3 > >( "Field" );
 
 			// check if spheres lie within data boundingbox
 			std::shared_ptr< const Grid< 3 > > grid = std::dynamic_pointer_cast< const Grid< 3 > >( field->domain() );
 
-			if( grid->index( grid->locate( p1 ) ) == 0 || grid->index( grid->locate( p2 ) ) == 0 ) {
+			// the handles may move while this runs
+			Point3 start, end;
+			{
+				std::lock_guard< std::mutex > lock( m_handleMutex );
+				start = p1;
+				end = p2;
+			}
+			if( !insideGrid( grid, start ) || !insideGrid( grid, end ) ) {
 				infoLog() << "Starting points out of bounds!" << std::endl;
 				return;
 			}
 
-			Vector3 startingLine = p2 - p1;
+			Vector3 startingLine = end - start;
 			float length = norm( startingLine );
 			//m_startingPoints->addArrow( Point3( 0.0, 0.0, 0.0 ) p1, startingLine, 0.1, Color( 0.0, 1.0, 0.0 ) );
 			//m_startingPoints->addSphere( p1 - Point3(0.0, 0.0, 1.0), 0.1, Color( 0.0, 1.0, 0.0 ) );
 			//m_startingPoints->addSphere( p2 + Point3(0.0, 0.0, 1.0), 0.1, Color( 0.0, 1.0, 0.0 ) );
 
-			std::vector< std::vector< Point3 > > vertices;
-
 			std::vector< Point3 > startingPoints( options.get< int >( "Starting points" ) );
 			
 			float distance = length / (float)startingPoints.size();
 			for (int i = 0; i < startingPoints.size(); i++)
 			{
-				startingPoints[i] = normalized( startingLine ) * ( distance * i ) + p1;
-				vertices.push_back( std::vector< Point3 >() );
+				startingPoints[i] = normalized( startingLine ) * ( distance * i ) + start;
 				//m_startingPoints->addSphere( startingPoints[i], 0.05, Color( 0.0, 1.0, 0.0, 1.0 ) );
 			}
 
 			float stepSize = options.get< float >( "Step size" );
-			const ValueArray< Point3 >& points = grid->points();
+			size_t maxSteps = std::max( options.get< int >( "Max steps" ), 1 );
+
+			// RK45 starts at the step size and may shrink it a thousandfold or grow it tenfold
+			integration::Tolerance tolerance;
+			tolerance.absolute = options.get< float >( "Absolute tolerance" );
+			tolerance.relative = options.get< float >( "Relative tolerance" );
+			tolerance.minStep = stepSize * 1e-3;
+			tolerance.maxStep = stepSize * 10;
+
+			size_t budget = size_t( std::max( options.get< int >( "Cache budget" ), 0 ) ) << 20;
+			bool useCache = budget > 0;
+			IntegrationCache::instance().requestBudget( this, budget );
+
+			// structured grids are sampled with the cell of the last step as location hint
+			std::shared_ptr< const StructuredVectorField > structured = structuredVectorField( field );
+
+			auto progress = [this]( size_t finished, size_t total ) {
+				debugLog() << "Integrated " << finished << " of " << total << " streamlines" << std::endl;
+			};
+
+			// Samplers of one thread, which pass fantom's abortFlag on to m_cancel.
+			auto watched = [this, &abortFlag]( auto sampler ) {
+				return [this, &abortFlag, sampler = std::move( sampler )]( const Point3& x, Vector3& v ) mutable {
+					if( abortFlag ) m_cancel = true;
+					return sampler( x, v );
+				};
+			};
+			auto withSampler = [&]( auto function ) {
+				if( structured ) function( [&]() { return watched( HintedField( *structured ) ); } );
+				else function( [&]() { return watched( EvaluatorField( *field ) ); } );
+			};
+
+			// Lines from seeds into vertices and offsets, the ones of earlier runs with the same
+			// parameters from the cache. Lines end once m_cancel is set, and then aren't cached.
+			auto integrate = [&]( const std::vector< Point3 >& seeds, double step, size_t steps, const integration::Tolerance& stepTolerance,
+								  std::vector< Point3 >& vertices, std::vector< size_t >& offsets ) {
+				IntegrationCache::Request request{ field, options.get< std::string >( "Algorithm" ) + ";" };
+				IntegrationCache::describe( request.parameters, "step", step );
+				IntegrationCache::describe( request.parameters, "max steps", steps );
+				if( method == integration::Method::RK45 ) {
+					IntegrationCache::describe( request.parameters, "absolute", stepTolerance.absolute );
+					IntegrationCache::describe( request.parameters, "relative", stepTolerance.relative );
+				}
 
-			
-			if( euler ) {
-				// ------------- Euler -------------
-				#pragma omp parallel for 
-				for( int i=0; i<startingPoints.size(); i++ ) {
-					auto evaluator = field->makeEvaluator();
-					while( grid->index( grid->locate( startingPoints[i] ) ) != 0 ) {
-						vertices[i].push_back( startingPoints[i] );
-
-						// get next interpolated position
-						Cell cell = grid->locate( startingPoints[i] );
-						if( evaluator->reset( startingPoints[i] ) ) {
-							Tensor< double, 3 > vector = evaluator->value();
-							startingPoints[i] = startingPoints[i] + ( normalized( vector ) * stepSize );
-						} else break;
-
-						vertices[i].push_back( startingPoints[i] );
+				integrateWithCache( request, seeds, useCache, &m_cancel, [&]( const std::vector< Point3 >& missing, LineArena< Point3 >& arena ) {
+					auto makeSink = [&arena]( size_t i, const Point3& ) {
+						return [&arena, i]( const Point3& x ) { arena.push( i, x ); };
+					};
+					integration::withStepper< Vector3 >( method, step, stepTolerance, [&]( const auto& stepper ) {
+						withSampler( [&]( auto makeSampler ) {
+							integration::integrateLines( stepper, euler, missing, steps, &m_cancel, makeSampler, makeSink, progress );
+						} );
+					} );
+				}, vertices, offsets );
+				return !m_cancel && !abortFlag;
+			};
+
+			std::vector< Point3 > vertices;
+			std::vector< size_t > offsets;
+
+			// Evenly-spaced lines depend on each other, so they have neither a preview nor cached lines.
+			double separation = options.get< float >( "Separation" );
+			if( separation > 0.0 ) {
+				integration::SpacingStats stats;
+				integration::withStepper< Vector3 >( method, stepSize, tolerance, [&]( const auto& stepper ) {
+					withSampler( [&]( auto makeSampler ) {
+						stats = integration::integrateEvenlySpaced( stepper, euler, startingPoints, maxSteps, separation, &m_cancel, makeSampler, vertices, offsets );
+					} );
+				} );
+				if( m_cancel || abortFlag ) return;
+				infoLog() << stats.lines << " streamlines from " << stats.candidates << " seeds in " << stats.steps << " steps" << std::endl;
+			} else {
+				// The preview covers the same arc length in a quarter of the steps. Its tolerances are
+				// loosened like the error of a fourth order method, else RK45 would shrink the steps back.
+				if( options.get< bool >( "Progressive" ) && startingPoints.size() >= 2 * previewStride ) {
+					std::vector< Point3 > previewPoints;
+					for( size_t i=0; i<startingPoints.size(); i+=previewStride ) {
+						previewPoints.push_back( startingPoints[i] );
 					}
+					integration::Tolerance previewTolerance = tolerance;
+					const double loosen = std::pow( double( previewStride ), 4 );
+					previewTolerance.absolute *= loosen;
+					previewTolerance.relative *= loosen;
+					previewTolerance.minStep *= previewStride;
+					previewTolerance.maxStep *= previewStride;
+
+					if( !integrate( previewPoints, stepSize * previewStride, std::max< size_t >( maxSteps / previewStride, 1 ), previewTolerance, vertices, offsets ) ) return;
+					draw( vertices, offsets, Color( 1.0, 0.0, 0.0, 0.5 ) );
 				}
-			} else {
-
-				// ------------ runge-kutta -------------
-				#pragma omp parallel for
-				for( int i=0; i<startingPoints.size(); i++ ) {
-					auto evaluator = field->makeEvaluator();
-					while( grid->index( grid->locate( startingPoints[i] ) ) != 0 ) {
-						vertices[i].push_back( startingPoints[i] );
 
-						Cell cell = grid->locate( startingPoints[i] );
-
-						Vector3 q1, q2, q3, q4;
-
-						//	q1
-						if( !evaluator->reset( startingPoints[i] ) ) break;
-						q1 = evaluator->value();
-
-						// q2
-						if( !evaluator->reset( startingPoints[i] + ( stepSize / 2 ) * q1 ) ) break;
-						q2 = evaluator->value();
-
-						// q3
-						if( !evaluator->reset( startingPoints[i] + ( stepSize / 2 ) * q2 ) ) break;;
-						q3 = evaluator->value();
-
-						// q4
-						if( !evaluator->reset( startingPoints[i] + stepSize * q3 ) ) break;
-						q4 = evaluator->value();
-
-						// n+1			  = ...
-						startingPoints[i] = startingPoints[i] + ( stepSize / 6 ) * ( q1 + 2*q2 + 2*q3 + q4 );
+				// a cancelled run leaves the preview, the next one replaces it
+				if( !integrate( startingPoints, stepSize, maxSteps, tolerance, vertices, offsets ) ) return;
+			}
+			double simplifyTolerance = options.get< float >( "Simplify tolerance" );
+			if( simplifyTolerance > 0.0 ) {
+				SimplifyStats stats = simplifyLines( vertices, offsets, simplifyTolerance );
+				infoLog() << "Simplified " << stats.inputVertices << " to " << stats.outputVertices << " vertices (" << stats.reduction() << "x), max deviation " << stats.maxDeviation << std::endl;
+			}
+			draw( vertices, offsets, Color( 1.0, 0.0, 0.0 ) );
+		}
 
-						vertices[i].push_back( startingPoints[i] );
-					}
+		// Replaces the streamlines by the lines of vertices, line i from offsets[i] to offsets[i+1].
+		// The segments of all lines, from every vertex to the next one, share one primitive.
+		void draw( const std::vector< Point3 >& vertices, const std::vector< size_t >& offsets, const Color& color ) {
+			m_streamLines = getGraphics( "streamlines" ).makePrimitive();
+			std::vector< Point3 > segments;
+			segments.reserve( 2 * vertices.size() );
+			for( size_t i=0; i+1<offsets.size(); i++ ) {
+				for( size_t j=offsets[i]+1; j<offsets[i+1]; j++ ) {
+					segments.push_back( vertices[j-1] );
+					segments.push_back( vertices[j] );
 				}
 			}
-
-			for( int i=0; i<vertices.size(); i++ ) {
-				m_streamLines->add( Primitive::LINES ).setColor( Color( 1.0, 0.0, 0.0 ) ).setVertices( vertices[i] );
+			if( !segments.empty() ) {
+				m_streamLines->add( Primitive::LINES ).setColor( color ).setVertices( segments );
 			}
-
 		}
 
 		Vector3 center( int i ) const {
@@ -193,10 +285,13 @@ namespace {
 			double d = ( t0 - s0 ) * ( t0 - s0 );
             if( d == 0.0 )
                 return;
+            // the lines being integrated start at the old seed line
+            m_cancel = true;
             Vector3 n = s - ( t0 - s0 ) * ( s * ( t0 - s0 ) ) / d;
             double m = ( n * ( center( i ) - s0 ) ) / ( n * s );
             if( i == 1 ) {
             	m_manipulator1->view().translate( ( t0 - s0 ) + ( t - s ) * m );
+            	std::lock_guard< std::mutex > lock( m_handleMutex );
             	p1 = Point3( 
             		m_manipulator1->view().matrix()[3 * 4 + 0],
             		m_manipulator1->view().matrix()[3 * 4 + 1],
@@ -206,6 +301,7 @@ namespace {
             }
             else {
             	m_manipulator2->view().translate( ( t0 - s0 ) + ( t - s ) * m );
+            	std::lock_guard< std::mutex > lock( m_handleMutex );
             	p2 = Point3( 
             		m_manipulator2->view().matrix()[3 * 4 + 0],
             		m_manipulator2->view().matrix()[3 * 4 + 1],
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace fantom
+{
+
+	/// Thread-safe least-recently-used cache whose entries are weighted by their size in bytes.
+	/// Inserting beyond the budget evicts the least recently used entries. Values are shared, so
+	/// evicting an entry never invalidates a value that is still in use.
+	template< typename Key, typename Value, typename Hash = std::hash< Key > >
+	class LRUCache {
+
+	public:
+		LRUCache( size_t budget ) :
+			m_budget( budget ),
+			m_used( 0 )
+		{
+
+		}
+
+		/// Returns the cached value for key and marks it as most recently used, or nullptr.
+		std::shared_ptr< const Value > get( const Key& key ) {
+			std::lock_guard< std::mutex > lock( m_mutex );
+			auto it = m_index.find( key );
+			if( it == m_index.end() ) return nullptr;
+			m_entries.splice( m_entries.begin(), m_entries, it->second );
+			return it->second->value;
+		}
+
+		bool contains( const Key& key ) const {
+			std::lock_guard< std::mutex > lock( m_mutex );
+			return m_index.count( key ) != 0;
+		}
+
+		/// Inserts or replaces the value for key. The new entry itself is never evicted, even if it
+		/// exceeds the budget on its own.
+		void put( const Key& key, std::shared_ptr< const Value > value, size_t bytes ) {
+			std::lock_guard< std::mutex > lock( m_mutex );
+			auto it = m_index.find( key );
+			if( it != m_index.end() ) {
+				m_used -= it->second->bytes;
+				m_entries.erase( it->second );
+			}
+			m_entries.push_front( Entry{ key, std::move( value ), bytes } );
+			m_index[key] = m_entries.begin();
+			m_used += bytes;
+			evict();
+		}
+
+		void setBudget( size_t budget ) {
+			std::lock_guard< std::mutex > lock( m_mutex );
+			m_budget = budget;
+			evict();
+		}
+
+		void clear() {
+			std::lock_guard< std::mutex > lock( m_mutex );
+			m_entries.clear();
+			m_index.clear();
+			m_used = 0;
+		}
+
+		/// Bytes held by all entries.
+		size_t used() const {
+			std::lock_guard< std::mutex > lock( m_mutex );
+			return m_used;
+		}
+
+	private:
+		struct Entry {
+			Key key;
+			std::shared_ptr< const Value > value;
+			size_t bytes;
+		};
+
+		mutable std::mutex m_mutex;
+		std::list< Entry > m_entries;
+		std::unordered_map< Key, typename std::list< Entry >::iterator, Hash > m_index;
+		size_t m_budget;
+		size_t m_used;
+
+		void evict() {
+			while( m_used > m_budget && m_entries.size() > 1 ) {
+				m_used -= m_entries.back().bytes;
+				m_index.erase( m_entries.back().key );
+				m_entries.pop_back();
+			}
+		}
+	};
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <omp.h>
+
+namespace fantom
+{
+
+	/// Collects the positions of many lines from the threads of a parallel region without a
+	/// vector per line. The positions of a line go into a list of fixed-size chunks, which every
+	/// thread takes from its own blocks, so appending never reallocates or copies, and threads
+	/// don't share allocations. A line may be continued by another thread, as long as only one
+	/// thread appends to it at a time. merge() puts all lines into one flat array.
+	///
+	/// numThreads has to be at least the number of threads of the regions that push.
+	template< typename V >
+	class LineArena {
+
+	public:
+		LineArena( size_t numLines, size_t numThreads = omp_get_max_threads() ) :
+			m_lines( numLines ),
+			m_threads( std::max< size_t >( numThreads, 1 ) )
+		{
+
+		}
+
+		size_t numLines() const {
+			return m_lines.size();
+		}
+
+		/// Appends x to line.
+		void push( size_t line, const V& x ) {
+			Chunk* chunk = m_lines[line].last;
+			if( !chunk || chunk->size == chunkSize ) chunk = grow( line );
+			chunk->points[ chunk->size++ ] = x;
+		}
+
+		/// Copies all lines into vertices one after the other, line i at offsets[i] up to
+		/// offsets[i+1].
+		void merge( std::vector< V >& vertices, std::vector< size_t >& offsets ) const {
+			const long long numLines = m_lines.size();
+			offsets.assign( numLines + 1, 0 );
+			#pragma omp parallel for schedule( dynamic, 256 )
+			for( long long i=0; i<numLines; i++ ) {
+				for( const Chunk* chunk = m_lines[i].first; chunk; chunk = chunk->next ) offsets[i+1] += chunk->size;
+			}
+			for( long long i=0; i<numLines; i++ ) offsets[i+1] += offsets[i];
+
+			// every line knows where it goes, so the threads copy them side by side
+			vertices.resize( offsets[numLines] );
+			#pragma omp parallel for schedule( dynamic, 256 )
+			for( long long i=0; i<numLines; i++ ) {
+				V* out = vertices.data() + offsets[i];
+				for( const Chunk* chunk = m_lines[i].first; chunk; chunk = chunk->next ) out = std::copy( chunk->points, chunk->points + chunk->size, out );
+			}
+		}
+
+	private:
+		static const size_t chunkSize = 32;
+		static const size_t blockChunks = 256;
+
+		struct Chunk {
+			V points[chunkSize];
+			size_t size = 0;
+			Chunk* next = nullptr;
+		};
+
+		struct Line {
+			Chunk* first = nullptr;
+			Chunk* last = nullptr;
+		};
+
+		struct alignas( 64 ) Thread {
+			std::vector< std::unique_ptr< Chunk[] > > blocks;
+			size_t used = blockChunks;
+		};
+
+		std::vector< Line > m_lines;
+		std::vector< Thread > m_threads;
+
+		// Links a new chunk of the calling thread to line.
+		Chunk* grow( size_t line ) {
+			Thread& thread = m_threads[ omp_get_thread_num() % m_threads.size() ];
+			if( thread.used == blockChunks ) {
+				thread.blocks.emplace_back( new Chunk[blockChunks] );
+				thread.used = 0;
+			}
+			Chunk* chunk = &thread.blocks.back()[ thread.used++ ];
+			Line& l = m_lines[line];
+			if( l.last ) l.last->next = chunk;
+			else l.first = chunk;
+			l.last = chunk;
+			return chunk;
+		}
+	};
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <fantom/datastructures/LineSet.hpp>
+
+namespace fantom
+{
+
+	/// LineSet of lines in one flat array, line i from offsets[i] to offsets[i+1], as
+	/// LineArena::merge() and the integrators produce them. LineSet only adds single points,
+	/// so the array is added in one pass and the lines refer to its indices.
+	inline std::shared_ptr< LineSet > makeLineSet( const std::vector< Point3 >& vertices, const std::vector< size_t >& offsets ) {
+		std::shared_ptr< LineSet > lineSet( new LineSet );
+		std::vector< size_t > indices( vertices.size() );
+		for( size_t i=0; i<vertices.size(); i++ ) {
+			indices[i] = lineSet->addPoint( vertices[i] );
+		}
+		std::vector< size_t > line;
+		for( size_t i=0; i+1<offsets.size(); i++ ) {
+			line.assign( indices.begin() + offsets[i], indices.begin() + offsets[i+1] );
+			lineSet->addLine( line );
+		}
+		return lineSet;
+	}
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace fantom
+{
+
+	/// Outcome of simplifyLines.
+	struct SimplifyStats {
+		size_t inputVertices = 0;
+		size_t outputVertices = 0;
+		double maxDeviation = 0.0;	///< largest distance of a removed vertex to the simplified line
+
+		double reduction() const {
+			return outputVertices > 0 ? double( inputVertices ) / outputVertices : 1.0;
+		}
+	};
+
+	/// Distance of p to the segment from a to b. V needs -, scalar *, the dot product a * b and
+	/// norm(), as fantom's tensors have.
+	template< typename V >
+	inline double segmentDistance( const V& p, const V& a, const V& b ) {
+		const auto ab = b - a;
+		const auto ap = p - a;
+		const double length = ab * ab;
+		const double t = length > 0.0 ? std::min( std::max( ( ap * ab ) / length, 0.0 ), 1.0 ) : 0.0;
+		return norm( ap - t * ab );
+	}
+
+	/// Simplifies every line of a flat line array, line i from offsets[i] to offsets[i+1], with
+	/// Douglas-Peucker: a vertex is dropped if it lies within tolerance of the segment between the
+	/// vertices kept around it. End points are always kept. Lines are simplified in parallel.
+	template< typename V >
+	inline SimplifyStats simplifyLines( std::vector< V >& vertices, std::vector< size_t >& offsets, double tolerance ) {
+		SimplifyStats stats;
+		stats.inputVertices = vertices.size();
+		const long long numLines = offsets.empty() ? 0 : offsets.size() - 1;
+
+		std::vector< char > keep( vertices.size(), 0 );
+		std::vector< size_t > kept( numLines + 1, 0 );
+		double maxDeviation = 0.0;
+		#pragma omp parallel reduction( max : maxDeviation )
+		{
+			std::vector< std::pair< size_t, size_t > > stack;
+
+			#pragma omp for schedule( dynamic, 16 )
+			for( long long l=0; l<numLines; l++ ) {
+				const size_t first = offsets[l];
+				const size_t last = offsets[l+1];
+				if( last - first <= 2 ) {
+					std::fill( keep.begin() + first, keep.begin() + last, 1 );
+					kept[l+1] = last - first;
+					continue;
+				}
+
+				keep[first] = keep[last-1] = 1;
+				size_t count = 2;
+				stack.assign( 1, std::make_pair( first, last - 1 ) );
+				while( !stack.empty() ) {
+					const size_t a = stack.back().first;
+					const size_t b = stack.back().second;
+					stack.pop_back();
+
+					size_t farthest = a;
+					double distance = 0.0;
+					for( size_t i=a+1; i<b; i++ ) {
+						double d = segmentDistance( vertices[i], vertices[a], vertices[b] );
+						if( d > distance ) {
+							distance = d;
+							farthest = i;
+						}
+					}
+					if( distance > tolerance ) {
+						keep[farthest] = 1;
+						count++;
+						stack.push_back( std::make_pair( a, farthest ) );
+						stack.push_back( std::make_pair( farthest, b ) );
+					} else {
+						maxDeviation = std::max( maxDeviation, distance );
+					}
+				}
+				kept[l+1] = count;
+			}
+		}
+		for( long long l=0; l<numLines; l++ ) kept[l+1] += kept[l];
+
+		std::vector< V > simplified( kept[numLines] );
+		#pragma omp parallel for schedule( dynamic, 64 )
+		for( long long l=0; l<numLines; l++ ) {
+			size_t out = kept[l];
+			for( size_t i=offsets[l]; i<offsets[l+1]; i++ ) {
+				if( keep[i] ) simplified[out++] = vertices[i];
+			}
+		}
+
+		vertices.swap( simplified );
+		offsets.swap( kept );
+		stats.outputVertices = vertices.size();
+		stats.maxDeviation = maxDeviation;
+		return stats;
+	}
+}
@@ -1,11 +1,14 @@
-#include <fstream>
-#include <sstream>
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include <fantom/algorithm.hpp>
 #include <fantom/register.hpp>
 #include <fantom/fields.hpp>
 
+#include "VTKFields.hpp"
+#include "VTKFile.hpp"
+
 using namespace fantom;
 
 namespace {
@@ -13,12 +16,6 @@ namespace {
 	class LoadVTK : public DataAlgorithm {
 
 	std::string m_vtkPath;
-	size_t m_dimX, m_dimY, m_dimZ;
-	size_t m_numPoints;
-	std::vector< float > m_points;
-	std::vector< float > m_values;
-
-	bool isVector;	
 
 	public:
 
@@ -32,6 +29,14 @@ namespace {
 			{
 
 				add< InputLoadPath >( "Load VTK", "Path to VTK file", "" );
+				add< int >( "Threads", "Number of threads for parsing ASCII files, 0 uses all cores", 0 );
+				add< bool >( "Use cache", "Keep a binary copy of the parsed data next to the file and reuse it while the file is unchanged", true );
+				add< bool >( "Verify cache", "Also compare the content of the file with the hash in the binary copy, for files replaced with their old modification time", false );
+				add< bool >( "Single precision", "Store coordinates and values as 32 bit floats to halve the memory of the grid and its fields", false );
+				add< bool >( "Detect regular grids", "Store axis-aligned grids as uniform or rectilinear domains without per-point coordinates", true );
+				addVtkRegionOptions( [this]( const std::string& name, const std::string& description, int value ) {
+					add< int >( name, description, value );
+				} );
 
 			}
 
@@ -50,7 +55,9 @@ namespace {
 			{
 
 				add< Grid< 3 > >( "grid" );
-				add< TensorFieldBase >( "tensor field" );
+				for( size_t a=0; a<vtkFieldOutputs; a++ ) {
+					add< TensorFieldBase >( vtkFieldOutputName( a ) );
+				}
 
 			}
 
@@ -65,157 +72,44 @@ namespace {
 
 
 		void execute( const Algorithm::Options& options, const volatile bool& ) {
-			m_points.clear();
-			m_values.clear();
-			
 			m_vtkPath = options.get< InputLoadPath >( "Load VTK" );
 			if( m_vtkPath != "" ) {
-				parseFile();
-
-				size_t extend[] = { m_dimX, m_dimY, m_dimZ };
-				std::vector< Tensor< double, 3 > > gridPoints;
-				for( int i=0; i<m_points.size(); i+=3 ) {
-					gridPoints.push_back( Tensor< double, 3 >( m_points.at(i), m_points.at(i+1), m_points.at(i+2) ) );
-					//if( i == 3 ) debugLog() << m_points.at(i) << std::endl;;
-				}
-				debugLog() << "grid points size: " << gridPoints.size() << std::endl;
-				std::shared_ptr< const DiscreteDomain< 3 > > domain = DomainFactory::makeDomainCurvilinear( extend, gridPoints );
-
-				std::vector< Tensor< double, 3 > > vectors;
-				std::vector< Tensor< double, 1 > > scalars;
-				if( isVector ) {
-					for( int i=0; i<m_values.size(); i+=3 ) {
-						vectors.push_back( Tensor< double, 3 >( m_values.at(i), m_values.at(i+1), m_values.at(i+2) ) );
-					}
-				} else {
-					for( int i=0; i<m_values.size(); i++ ) {
-						scalars.push_back( Tensor< double, 1 >( m_values.at(i) ) );
-					}
-				}
-
-				std::shared_ptr< const Grid< 3 > > grid = DomainFactory::makeGridStructured( *domain );
-				setResult( "grid", grid );
-				if( isVector ) {
-					std::shared_ptr< const TensorFieldBase > tensorField = DomainFactory::makeTensorField( *grid, vectors );
-					setResult( "tensor field", tensorField );
-				} else {
-					std::shared_ptr< const TensorFieldBase > tensorField = DomainFactory::makeTensorField( *grid, scalars );
-					setResult( "tensor field", tensorField );	
-				}
-
-			} else {
-				infoLog() << "No input file was selected!" << std::endl;
-				return;
-			}
-		}
-
-	private:
-
-		void parseFile() {
-
-			// read file into string
-			std::ifstream inFile( m_vtkPath );
-			std::string str;
-			getline( inFile, str, char(-1) );
-			inFile.close();
-
-			std::vector< std::string > lines;
-			split( str, '\n', lines );
-
-			debugLog() << "Number of lines: " << lines.size() << std::endl;
-
-			bool startPointParsing = false;
-			bool startValueParsing = false;
-
-			// parse for value type
-			for( size_t i=0; i<lines.size(); i++ ) {
-				if( lines.at(i).find("VECTORS") != -1 ) {
-					isVector = true;
-					break;
-				} else if( lines.at(i).find("SCALARS") != -1 ) {
-					isVector = false;
-					break;
-				}
-			}
-
-			for( size_t i=0; i<lines.size(); i++ ) {
-
-				// read dimensions x, y, z
-				if( lines.at(i).find("DIMENSIONS") != -1 ) {
-					std::vector< std::string > dimensions;
-					split( lines.at(i), ' ', dimensions );
-
-					m_dimX = std::stoi( dimensions[1] );
-					m_dimY = std::stoi( dimensions[2] );
-					m_dimZ = std::stoi( dimensions[3] );
-
-					debugLog() << "Dimensions: " << m_dimX << " | " << m_dimY << " | " << m_dimZ << std::endl;
+				// sub-box and level of detail, large files are never loaded completely
+				VtkReadOptions read;
+				read.useCache = options.get< bool >( "Use cache" );
+				read.verifyCache = options.get< bool >( "Verify cache" );
+				read.numThreads = options.get< int >( "Threads" );
+				read.region = vtkRegion( options );
+
+				VtkDataset data;
+				std::string error;
+				if( !readVtkFile( m_vtkPath, data, error, read ) ) {
+					infoLog() << "Failed to load " << m_vtkPath << ": " << error << std::endl;
+					return;
 				}
+				debugLog() << "Dimensions: " << data.dims[0] << " | " << data.dims[1] << " | " << data.dims[2] << std::endl;
+				debugLog() << "Points size: " << data.points.size() << std::endl;
+				debugLog() << "Arrays: " << data.arrays.size() << std::endl;
 
-				// read num points
-				if( lines.at(i).find("POINTS") != -1 ) {
-					std::vector< std::string > points;
-					split( lines.at(i), ' ', points );
-					m_numPoints = std::stoi( points[1] );
-					m_points.reserve( m_numPoints );
-
-					startPointParsing = true;
-
-					continue;
-				}
-
-				if( lines.at(i).find("VECTORS") != -1 ) {
-
-					startPointParsing = false;
-					startValueParsing = true;
+				if( options.get< bool >( "Detect regular grids" ) ) detectRegularLayout( data );
 
-					continue;
-				} else if( lines.at(i).find("SCALARS") != -1 ) {
+				if( data.layout == VtkLayout::Uniform ) debugLog() << "Uniform grid" << std::endl;
+				else if( data.layout == VtkLayout::Rectilinear ) debugLog() << "Rectilinear grid" << std::endl;
 
-					startPointParsing = false;
-					startValueParsing = true;
-
-					continue;
-				}
-
-				if( lines.at(i).find("POINT_DATA") != -1 ) continue;
-
-				// read points
-				if( startPointParsing ) {
-					std::vector< std::string > fieldData;
-					if( isVector) split( lines.at(i), ' ', fieldData );
-
-					else split( lines.at(i), '\t', fieldData );
-					for( size_t j=0; j<fieldData.size(); j++ ) {
-						m_points.push_back( std::stof( fieldData.at(j) ) );
-					}
-				}
+				Precision precision = options.get< bool >( "Single precision" ) ? Precision::FLOAT32 : Precision::FLOAT64;
+				std::shared_ptr< const VtkFieldData > loaded = makeVtkFieldData( data, precision );
+				setResult( "grid", loaded->grid );
 
-				// read vectors
-				if( startValueParsing ) {
-					std::vector< std::string > vectors;
-					if( isVector ) split( lines.at(i), ' ', vectors );
-					else split( lines.at(i), '\t', vectors );
+				// every array becomes its own output, all on the same grid
+				exposeVtkFields( *loaded, [this]( const std::string& name, const std::shared_ptr< const TensorFieldBase >& field ) {
+					setResult( name, field );
+				}, [this]( const std::string& message ) {
+					infoLog() << message << std::endl;
+				} );
 
-					for( int j=0; j<vectors.size(); j++ ) {
-						m_values.push_back( std::stof( vectors.at(j) ) );
-					}
-				}
-
-
-			}
-
-			debugLog() << "Points size: " << m_points.size() << std::endl;
-			debugLog() << "Vector size: " << m_values.size() << std::endl;
-
-
-		}
-
-		void split( const std::string &s, char delim, std::vector< std::string >& res ) {
-			std::stringstream sStream( s );
-			std::string item;
-			while( std::getline( sStream, item, delim ) ) {
-				res.push_back( item );
+			} else {
+				infoLog() << "No input file was selected!" << std::endl;
+				return;
 			}
 		}
 
@@ -0,0 +1,143 @@
+#include <memory>
+#include <string>
+
+#include <fantom/algorithm.hpp>
+#include <fantom/register.hpp>
+#include <fantom/fields.hpp>
+
+#include "TimeSeries.hpp"
+#include "VTKFields.hpp"
+#include "VTKFile.hpp"
+
+using namespace fantom;
+
+namespace {
+
+	class LoadVTKTimeSeries : public DataAlgorithm {
+
+	std::string m_pattern;
+	bool m_detectRegular;
+	bool m_singlePrecision;
+	bool m_useCache;
+	VtkRegion m_region;
+	std::unique_ptr< TimeSeries< VtkFieldData > > m_series;
+
+	public:
+
+		static const bool isAutoRun = true;
+
+		// options
+		struct Options : public DataAlgorithm::Options {
+
+			Options( fantom::Options::Control& control ) :
+				DataAlgorithm::Options( control )
+			{
+
+				add< std::string >( "Files", "File pattern like /data/run_*.vtk or a .pvd collection", "" );
+				add< int >( "Time step", "Index of the time step to output", 0 );
+				add< int >( "Memory budget", "Memory for cached time steps in MB", 4096 );
+				add< bool >( "Prefetch", "Load the next time step in the background", true );
+				add< bool >( "Single precision", "Store coordinates and values as 32 bit floats, so that twice as many steps fit into the budget", false );
+				add< bool >( "Detect regular grids", "Store axis-aligned grids as uniform or rectilinear domains", true );
+				add< bool >( "Use cache", "Keep a binary copy of every parsed legacy file next to it and reuse it while the file is unchanged", false );
+				addVtkRegionOptions( [this]( const std::string& name, const std::string& description, int value ) {
+					add< int >( name, description, value );
+				} );
+
+			}
+
+		};
+
+		// intput / output
+		struct DataOutputs : public DataAlgorithm::DataOutputs {
+
+			DataOutputs( fantom::DataOutputs::Control& control ) :
+				DataAlgorithm::DataOutputs( control )
+			{
+
+				add< Grid< 3 > >( "grid" );
+				for( size_t a=0; a<vtkFieldOutputs; a++ ) {
+					add< TensorFieldBase >( vtkFieldOutputName( a ) );
+				}
+
+			}
+
+		};
+
+		// constructor
+		LoadVTKTimeSeries( InitData& data ) :
+			DataAlgorithm( data ),
+			m_detectRegular( true ),
+			m_singlePrecision( false ),
+			m_useCache( false )
+		{
+
+		}
+
+
+		void execute( const Algorithm::Options& options, const volatile bool& ) {
+			std::string pattern = options.get< std::string >( "Files" );
+			bool detectRegular = options.get< bool >( "Detect regular grids" );
+			bool singlePrecision = options.get< bool >( "Single precision" );
+			bool useCache = options.get< bool >( "Use cache" );
+			VtkRegion region = vtkRegion( options );
+			if( pattern == "" ) {
+				infoLog() << "No input files were selected!" << std::endl;
+				return;
+			}
+			size_t budget = size_t( std::max( options.get< int >( "Memory budget" ), 0 ) ) << 20;
+
+			// index the series once, the files themselves are only read on request
+			if( !m_series || pattern != m_pattern || detectRegular != m_detectRegular || singlePrecision != m_singlePrecision || useCache != m_useCache || region != m_region ) {
+				m_series.reset();
+				std::vector< TimeStep > steps;
+				std::string error;
+				if( !indexVtkSeries( pattern, steps, error ) ) {
+					infoLog() << error << std::endl;
+					return;
+				}
+				debugLog() << "Indexed " << steps.size() << " time steps" << std::endl;
+
+				// every step is restricted to the same region
+				Precision precision = singlePrecision ? Precision::FLOAT32 : Precision::FLOAT64;
+				VtkReadOptions read;
+				read.useCache = useCache;
+				read.region = region;
+				m_series.reset( new TimeSeries< VtkFieldData >( steps, [detectRegular, precision, read]( const TimeStep& step, size_t& bytes, std::string& error ) {
+					return loadVtkFieldData( step.path, detectRegular, precision, read, bytes, error );
+				}, budget ) );
+				m_pattern = pattern;
+				m_detectRegular = detectRegular;
+				m_singlePrecision = singlePrecision;
+				m_useCache = useCache;
+				m_region = region;
+			}
+			m_series->setBudget( budget );
+
+			int index = options.get< int >( "Time step" );
+			if( index < 0 || size_t( index ) >= m_series->size() ) {
+				infoLog() << "Time step " << index << " out of range [0, " << m_series->size() - 1 << "]" << std::endl;
+				return;
+			}
+
+			const TimeStep& step = m_series->steps()[index];
+			std::shared_ptr< const VtkFieldData > data = m_series->get( index, options.get< bool >( "Prefetch" ) );
+			if( !data ) {
+				infoLog() << "Failed to load " << step.path << ": " << m_series->error( index ) << std::endl;
+				return;
+			}
+			debugLog() << "Time " << step.time << ", cached " << ( m_series->memoryUsed() >> 20 ) << " MB" << std::endl;
+
+			setResult( "grid", data->grid );
+			exposeVtkFields( *data, [this]( const std::string& name, const std::shared_ptr< const TensorFieldBase >& field ) {
+				setResult( name, field );
+			}, [this]( const std::string& message ) {
+				debugLog() << message << std::endl;
+			} );
+		}
+
+	};
+
+	AlgorithmRegister< LoadVTKTimeSeries > reg( "VisPraktikum/LoadVTKTimeSeries", "Loads time steps of an unsteady VTK dataset on demand" );
+
+}
@@ -0,0 +1,102 @@
+#include <string>
+#include <vector>
+
+#include <fantom/algorithm.hpp>
+#include <fantom/register.hpp>
+#include <fantom/fields.hpp>
+
+#include "VTKFields.hpp"
+#include "VTKFile.hpp"
+
+using namespace fantom;
+
+namespace {
+
+	class LoadVTKXML : public DataAlgorithm {
+
+	std::string m_vtkPath;
+
+	public:
+
+		static const bool isAutoRun = true;
+
+		// options
+		struct Options : public DataAlgorithm::Options {
+
+			Options( fantom::Options::Control& control ) :
+				DataAlgorithm::Options( control )
+			{
+
+				add< InputLoadPath >( "Load VTK XML", "Path to .vti, .vtr or .vts file", "" );
+				add< bool >( "Single precision", "Store coordinates and values as 32 bit floats to halve the memory of the grid and its fields", false );
+				add< bool >( "Detect regular grids", "Store axis-aligned structured grids as uniform or rectilinear domains", true );
+				addVtkRegionOptions( [this]( const std::string& name, const std::string& description, int value ) {
+					add< int >( name, description, value );
+				} );
+
+			}
+
+		};
+
+		// intput / output
+		struct DataOutputs : public DataAlgorithm::DataOutputs {
+
+			DataOutputs( fantom::DataOutputs::Control& control ) :
+				DataAlgorithm::DataOutputs( control )
+			{
+
+				add< Grid< 3 > >( "grid" );
+				for( size_t a=0; a<vtkFieldOutputs; a++ ) {
+					add< TensorFieldBase >( vtkFieldOutputName( a ) );
+				}
+
+			}
+
+		};
+
+		// constructor
+		LoadVTKXML( InitData& data ) :
+			DataAlgorithm( data )
+		{
+
+		}
+
+
+		void execute( const Algorithm::Options& options, const volatile bool& ) {
+			m_vtkPath = options.get< InputLoadPath >( "Load VTK XML" );
+			if( m_vtkPath == "" ) {
+				infoLog() << "No input file was selected!" << std::endl;
+				return;
+			}
+
+			// the arrays may be compressed, so the file is read completely and then cropped
+			VtkReadOptions read;
+			read.region = vtkRegion( options );
+			VtkDataset data;
+			std::string error;
+			if( !readVtkFile( m_vtkPath, data, error, read ) ) {
+				infoLog() << "Failed to load " << m_vtkPath << ": " << error << std::endl;
+				return;
+			}
+			debugLog() << "Dimensions: " << data.dims[0] << " | " << data.dims[1] << " | " << data.dims[2] << std::endl;
+			debugLog() << "Arrays: " << data.arrays.size() << std::endl;
+
+			if( options.get< bool >( "Detect regular grids" ) ) detectRegularLayout( data );
+
+			Precision precision = options.get< bool >( "Single precision" ) ? Precision::FLOAT32 : Precision::FLOAT64;
+			std::shared_ptr< const VtkFieldData > loaded = makeVtkFieldData( data, precision );
+			setResult( "grid", loaded->grid );
+
+			// every array becomes its own output, all on the same grid
+			exposeVtkFields( *loaded, [this]( const std::string& name, const std::shared_ptr< const TensorFieldBase >& field ) {
+				setResult( name, field );
+			}, [this]( const std::string& message ) {
+				infoLog() << message << std::endl;
+			} );
+		}
+
+	};
+
+	AlgorithmRegister< LoadVTKXML > reg( "VisPraktikum/LoadVTKXML", "Loads VTK XML image data and structured grid files" );
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fantom
+{
+
+	/// Read-only memory mapping of a whole file.
+	class MappedFile {
+
+	public:
+		MappedFile( const std::string& path ) :
+			m_data( nullptr ),
+			m_size( 0 )
+		{
+			int fd = ::open( path.c_str(), O_RDONLY );
+			if( fd < 0 ) return;
+
+			struct stat info;
+			if( ::fstat( fd, &info ) == 0 && info.st_size > 0 ) {
+				void* addr = ::mmap( nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+				if( addr != MAP_FAILED ) {
+					m_data = static_cast< const char* >( addr );
+					m_size = info.st_size;
+				}
+			}
+			// the mapping stays valid after the descriptor is closed
+			::close( fd );
+		}
+
+		~MappedFile() {
+			if( m_data ) ::munmap( const_cast< char* >( m_data ), m_size );
+		}
+
+		MappedFile( const MappedFile& ) = delete;
+		MappedFile& operator=( const MappedFile& ) = delete;
+
+		bool isOpen() const {
+			return m_data != nullptr;
+		}
+
+		const char* data() const {
+			return m_data;
+		}
+
+		size_t size() const {
+			return m_size;
+		}
+
+		/// Tells the kernel that [offset, offset+length) will be read front to back.
+		void adviseSequential( size_t offset, size_t length ) const {
+			size_t page = ::sysconf( _SC_PAGESIZE );
+			size_t begin = offset / page * page;
+			if( begin < m_size ) {
+				char* addr = const_cast< char* >( m_data ) + begin;
+				size_t bytes = std::min( m_size, offset + length ) - begin;
+				::madvise( addr, bytes, MADV_SEQUENTIAL );
+				::madvise( addr, bytes, MADV_WILLNEED );
+			}
+		}
+
+	private:
+		const char* m_data;
+		size_t m_size;
+	};
+}
@@ -0,0 +1,449 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include <omp.h>
+
+#include "StructuredGrid.hpp"
+#include "TaskPool.hpp"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#include <immintrin.h>
+#define PACKETINTEGRATION_X86
+#endif
+
+namespace fantom
+{
+	namespace integration
+	{
+
+		/// Whether integratePacketsRK4 can integrate field. Packets locate arithmetically, so the
+		/// grid has to be uniform, and its point indices have to fit the 32 bit gather indices.
+		/// Values in either precision are fine.
+		inline bool supportsPackets( const StructuredVectorField& field ) {
+			return field.grid().layout() == GridLayout::Uniform && field.grid().numPoints() < size_t( INT_MAX );
+		}
+
+		namespace detail
+		{
+			inline const double* componentValues( const StructuredVectorField& field, size_t d, double ) {
+				return field.values( d );
+			}
+
+			inline const float* componentValues( const StructuredVectorField& field, size_t d, float ) {
+				return field.floatValues( d );
+			}
+
+			// Everything a lane needs to locate in a uniform grid.
+			struct UniformLattice {
+				double origin[3];
+				double inverseSpacing[3];
+				double upper[3];
+				int last[3];
+				int stride[3];
+
+				UniformLattice( const StructuredGrid& grid ) {
+					for( size_t d=0; d<3; d++ ) {
+						origin[d] = grid.origin( d );
+						inverseSpacing[d] = 1.0 / grid.spacing( d );
+						upper[d] = double( grid.dim( d ) - 1 );
+						last[d] = int( grid.dim( d ) ) - 2;
+					}
+					stride[0] = 1;
+					stride[1] = int( grid.dim( 0 ) );
+					stride[2] = int( grid.dim( 0 ) * grid.dim( 1 ) );
+				}
+			};
+
+			// Everything a lane needs to sample a uniform field with values of type T.
+			template< typename T >
+			struct UniformSampler : UniformLattice {
+				const T* values[3];
+
+				UniformSampler( const StructuredVectorField& field ) :
+					UniformLattice( field.grid() )
+				{
+					for( size_t d=0; d<3; d++ ) values[d] = componentValues( field, d, T() );
+				}
+			};
+
+			// Cell and local coordinate of u along axis d of one lane.
+			inline double axisCoordinate( const UniformLattice& s, size_t d, double x, int& in, int& base ) {
+				double u = ( x - s.origin[d] ) * s.inverseSpacing[d];
+				in &= ( u >= 0.0 ) & ( u <= s.upper[d] );
+				// clamp lanes outside, NaN included, into the grid to keep the gathers valid
+				u = u > 0.0 ? u : 0.0;
+				u = u < s.upper[d] ? u : s.upper[d];
+				int c = int( u );
+				c = c < s.last[d] ? c : s.last[d];
+				base += c * s.stride[d];
+				return u - c;
+			}
+
+			// Trilinear interpolation of one component between the x-edges e0 to e3.
+			template< typename T >
+			inline double trilinearLane( const T* values, int e0, int e1, int e2, int e3, double x, double y, double z ) {
+				double sum = ( 1.0 - y ) * ( 1.0 - z ) * ( ( 1.0 - x ) * values[e0] + x * values[e0+1] );
+				sum += y * ( 1.0 - z ) * ( ( 1.0 - x ) * values[e1] + x * values[e1+1] );
+				sum += ( 1.0 - y ) * z * ( ( 1.0 - x ) * values[e2] + x * values[e2+1] );
+				sum += y * z * ( ( 1.0 - x ) * values[e3] + x * values[e3+1] );
+				return sum;
+			}
+
+			// Samples W positions, one lane per position. Lanes outside of the grid get a zero
+			// velocity and inside[l] = 0.
+			template< size_t W, typename T >
+			inline void sampleLanes( const UniformSampler< T >& s, const double p[3][W], double v[3][W], int inside[W] ) {
+				#pragma omp simd
+				for( size_t l=0; l<W; l++ ) {
+					int in = 1;
+					int base = 0;
+					const double x = axisCoordinate( s, 0, p[0][l], in, base );
+					const double y = axisCoordinate( s, 1, p[1][l], in, base );
+					const double z = axisCoordinate( s, 2, p[2][l], in, base );
+					const int e0 = base, e1 = base + s.stride[1], e2 = base + s.stride[2], e3 = base + s.stride[1] + s.stride[2];
+					const double vx = trilinearLane( s.values[0], e0, e1, e2, e3, x, y, z );
+					const double vy = trilinearLane( s.values[1], e0, e1, e2, e3, x, y, z );
+					const double vz = trilinearLane( s.values[2], e0, e1, e2, e3, x, y, z );
+					v[0][l] = in ? vx : 0.0;
+					v[1][l] = in ? vy : 0.0;
+					v[2][l] = in ? vz : 0.0;
+					inside[l] = in;
+				}
+			}
+
+#ifdef PACKETINTEGRATION_X86
+			// Four values at the indices as doubles, single precision ones are widened after the
+			// gather. The masked gathers with all lanes set avoid reading an undefined source vector.
+			__attribute__(( target( "avx2" ) ))
+			inline __m256d gatherAVX2( const double* values, __m128i indices ) {
+				const __m256d zero = _mm256_setzero_pd();
+				return _mm256_mask_i32gather_pd( zero, values, indices, _mm256_cmp_pd( zero, zero, _CMP_EQ_OQ ), 8 );
+			}
+
+			__attribute__(( target( "avx2" ) ))
+			inline __m256d gatherAVX2( const float* values, __m128i indices ) {
+				const __m128 zero = _mm_setzero_ps();
+				return _mm256_cvtps_pd( _mm_mask_i32gather_ps( zero, values, indices, _mm_cmpeq_ps( zero, zero ), 4 ) );
+			}
+
+			// sampleLanes with four lanes per AVX2 vector and gathers for the corner values. The
+			// arithmetic follows the scalar lane, so all instruction sets integrate the same lines.
+			template< size_t W, typename T >
+			__attribute__(( target( "avx2" ) ))
+			inline void sampleLanesAVX2( const UniformSampler< T >& s, const double p[3][W], double v[3][W], int inside[W] ) {
+				static_assert( W % 4 == 0, "AVX2 samples four lanes at a time" );
+				const __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd( 1.0 );
+				const __m256d all = _mm256_cmp_pd( zero, zero, _CMP_EQ_OQ );
+				for( size_t l=0; l<W; l+=4 ) {
+					__m256d in = all;
+					__m128i base = _mm_setzero_si128();
+					__m256d local[3];
+					for( size_t d=0; d<3; d++ ) {
+						const __m256d upper = _mm256_set1_pd( s.upper[d] );
+						__m256d u = _mm256_mul_pd( _mm256_sub_pd( _mm256_loadu_pd( &p[d][l] ), _mm256_set1_pd( s.origin[d] ) ), _mm256_set1_pd( s.inverseSpacing[d] ) );
+						in = _mm256_and_pd( in, _mm256_and_pd( _mm256_cmp_pd( u, zero, _CMP_GE_OQ ), _mm256_cmp_pd( u, upper, _CMP_LE_OQ ) ) );
+						// max returns its second operand for NaN
+						u = _mm256_min_pd( _mm256_max_pd( u, zero ), upper );
+						__m128i c = _mm_min_epi32( _mm256_cvttpd_epi32( u ), _mm_set1_epi32( s.last[d] ) );
+						local[d] = _mm256_sub_pd( u, _mm256_cvtepi32_pd( c ) );
+						base = _mm_add_epi32( base, _mm_mullo_epi32( c, _mm_set1_epi32( s.stride[d] ) ) );
+					}
+
+					const __m256d x = local[0], y = local[1], z = local[2];
+					const __m256d x0 = _mm256_sub_pd( one, x ), y0 = _mm256_sub_pd( one, y ), z0 = _mm256_sub_pd( one, z );
+					const __m256d weights[4] = { _mm256_mul_pd( y0, z0 ), _mm256_mul_pd( y, z0 ), _mm256_mul_pd( y0, z ), _mm256_mul_pd( y, z ) };
+					const __m128i dy = _mm_set1_epi32( s.stride[1] ), dz = _mm_set1_epi32( s.stride[2] );
+					const __m128i edges[4] = { base, _mm_add_epi32( base, dy ), _mm_add_epi32( base, dz ), _mm_add_epi32( _mm_add_epi32( base, dy ), dz ) };
+					for( size_t d=0; d<3; d++ ) {
+						__m256d sum = zero;
+						for( size_t e=0; e<4; e++ ) {
+							__m256d lower = gatherAVX2( s.values[d], edges[e] );
+							__m256d next = gatherAVX2( s.values[d] + 1, edges[e] );
+							__m256d edge = _mm256_mul_pd( weights[e], _mm256_add_pd( _mm256_mul_pd( x0, lower ), _mm256_mul_pd( x, next ) ) );
+							sum = e == 0 ? edge : _mm256_add_pd( sum, edge );
+						}
+						_mm256_storeu_pd( &v[d][l], _mm256_and_pd( in, sum ) );
+					}
+					int mask = _mm256_movemask_pd( in );
+					for( size_t i=0; i<4; i++ ) inside[l+i] = ( mask >> i ) & 1;
+				}
+			}
+
+			// GCC 12 takes the undefined pass-through operand of the AVX-512 intrinsics for an
+			// uninitialized read.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+			__attribute__(( target( "avx512f" ) ))
+			inline __m512d gatherAVX512( const double* values, __m256i indices ) {
+				return _mm512_i32gather_pd( indices, values, 8 );
+			}
+
+			__attribute__(( target( "avx512f" ) ))
+			inline __m512d gatherAVX512( const float* values, __m256i indices ) {
+				return _mm512_cvtps_pd( _mm256_i32gather_ps( values, indices, 4 ) );
+			}
+
+			// sampleLanes with eight lanes per AVX-512 vector.
+			template< size_t W, typename T >
+			__attribute__(( target( "avx512f" ) ))
+			inline void sampleLanesAVX512( const UniformSampler< T >& s, const double p[3][W], double v[3][W], int inside[W] ) {
+				static_assert( W % 8 == 0, "AVX-512 samples eight lanes at a time" );
+				const __m512d zero = _mm512_setzero_pd(), one = _mm512_set1_pd( 1.0 );
+				for( size_t l=0; l<W; l+=8 ) {
+					__mmask8 in = 0xff;
+					__m256i base = _mm256_setzero_si256();
+					__m512d local[3];
+					for( size_t d=0; d<3; d++ ) {
+						const __m512d upper = _mm512_set1_pd( s.upper[d] );
+						__m512d u = _mm512_mul_pd( _mm512_sub_pd( _mm512_loadu_pd( &p[d][l] ), _mm512_set1_pd( s.origin[d] ) ), _mm512_set1_pd( s.inverseSpacing[d] ) );
+						in &= _mm512_cmp_pd_mask( u, zero, _CMP_GE_OQ ) & _mm512_cmp_pd_mask( u, upper, _CMP_LE_OQ );
+						u = _mm512_min_pd( _mm512_max_pd( u, zero ), upper );
+						__m256i c = _mm256_min_epi32( _mm512_cvttpd_epi32( u ), _mm256_set1_epi32( s.last[d] ) );
+						local[d] = _mm512_sub_pd( u, _mm512_cvtepi32_pd( c ) );
+						base = _mm256_add_epi32( base, _mm256_mullo_epi32( c, _mm256_set1_epi32( s.stride[d] ) ) );
+					}
+
+					const __m512d x = local[0], y = local[1], z = local[2];
+					const __m512d x0 = _mm512_sub_pd( one, x ), y0 = _mm512_sub_pd( one, y ), z0 = _mm512_sub_pd( one, z );
+					const __m512d weights[4] = { _mm512_mul_pd( y0, z0 ), _mm512_mul_pd( y, z0 ), _mm512_mul_pd( y0, z ), _mm512_mul_pd( y, z ) };
+					const __m256i dy = _mm256_set1_epi32( s.stride[1] ), dz = _mm256_set1_epi32( s.stride[2] );
+					const __m256i edges[4] = { base, _mm256_add_epi32( base, dy ), _mm256_add_epi32( base, dz ), _mm256_add_epi32( _mm256_add_epi32( base, dy ), dz ) };
+					for( size_t d=0; d<3; d++ ) {
+						__m512d sum = zero;
+						for( size_t e=0; e<4; e++ ) {
+							__m512d lower = gatherAVX512( s.values[d], edges[e] );
+							__m512d next = gatherAVX512( s.values[d] + 1, edges[e] );
+							__m512d edge = _mm512_mul_pd( weights[e], _mm512_add_pd( _mm512_mul_pd( x0, lower ), _mm512_mul_pd( x, next ) ) );
+							sum = e == 0 ? edge : _mm512_add_pd( sum, edge );
+						}
+						_mm512_storeu_pd( &v[d][l], _mm512_maskz_mov_pd( in, sum ) );
+					}
+					for( size_t i=0; i<8; i++ ) inside[l+i] = ( in >> i ) & 1;
+				}
+			}
+#pragma GCC diagnostic pop
+#endif
+
+			// Sampling stage of the packet kernels for each instruction set.
+			struct DefaultLanes {
+				template< size_t W, typename T >
+				static void sample( const UniformSampler< T >& s, const double p[3][W], double v[3][W], int inside[W] ) {
+					sampleLanes< W >( s, p, v, inside );
+				}
+			};
+
+#ifdef PACKETINTEGRATION_X86
+			struct AVX2Lanes {
+				template< size_t W, typename T >
+				__attribute__(( target( "avx2" ) ))
+				static void sample( const UniformSampler< T >& s, const double p[3][W], double v[3][W], int inside[W] ) {
+					sampleLanesAVX2< W >( s, p, v, inside );
+				}
+			};
+
+			struct AVX512Lanes {
+				template< size_t W, typename T >
+				__attribute__(( target( "avx512f" ) ))
+				static void sample( const UniformSampler< T >& s, const double p[3][W], double v[3][W], int inside[W] ) {
+					sampleLanesAVX512< W >( s, p, v, inside );
+				}
+			};
+#endif
+
+			// A line of the packet kernels between slices; steps counts all of its steps so far.
+			struct PacketLine {
+				size_t seed;
+				double x[3];
+				size_t steps;
+			};
+
+			// Advances the lines of pool in packets of W lanes with RK4 until the pool is done. A
+			// lane whose line ends, or has run sliceSteps steps and goes back to the pool as a
+			// continuation, takes the next line right away, so the packet stays full while there
+			// is work. Thread 0 reports progress about twice a second. Returns the number of steps.
+			template< size_t W, typename Lanes, typename Sampler, typename Sink, typename Progress >
+			inline size_t runPacketsRK4( const Sampler& sampler, TaskPool< PacketLine >& pool, size_t thread, double h, size_t maxSteps,
+										 size_t sliceSteps, AbortFlag abortFlag, Sink& sink, Progress& progress ) {
+				double x[3][W], p[3][W], k1[3][W], k2[3][W], k3[3][W], k4[3][W];
+				int in1[W], in2[W], in3[W], in4[W];
+				PacketLine line[W];
+				size_t slice[W];
+				bool active[W];
+				size_t numActive = 0;
+				size_t total = 0;
+				auto reported = std::chrono::steady_clock::now();
+
+				auto take = [&]( size_t l, const PacketLine& task ) {
+					line[l] = task;
+					slice[l] = 0;
+					active[l] = true;
+					for( size_t d=0; d<3; d++ ) x[d][l] = task.x[d];
+					numActive++;
+				};
+
+				for( size_t l=0; l<W; l++ ) {
+					for( size_t d=0; d<3; d++ ) x[d][l] = 0.0;
+					active[l] = false;
+				}
+
+				for( ;; ) {
+					// idle lanes take queued lines without waiting, the lines in the other lanes
+					// are still pending; only an empty packet waits for work
+					for( size_t l=0; l<W && !( abortFlag && *abortFlag ); l++ ) {
+						if( active[l] ) continue;
+						std::optional< PacketLine > task = pool.tryNext( thread );
+						if( !task ) break;
+						take( l, *task );
+					}
+					if( numActive == 0 ) {
+						std::optional< PacketLine > task = pool.next( thread, abortFlag );
+						if( !task ) break;
+						take( 0, *task );
+						continue;
+					}
+
+					// the stages of RK4 in the same order of operations as RK4::step
+					Lanes::template sample< W >( sampler, x, k1, in1 );
+					for( size_t d=0; d<3; d++ ) {
+						#pragma omp simd
+						for( size_t l=0; l<W; l++ ) p[d][l] = x[d][l] + ( h / 2 ) * k1[d][l];
+					}
+					Lanes::template sample< W >( sampler, p, k2, in2 );
+					for( size_t d=0; d<3; d++ ) {
+						#pragma omp simd
+						for( size_t l=0; l<W; l++ ) p[d][l] = x[d][l] + ( h / 2 ) * k2[d][l];
+					}
+					Lanes::template sample< W >( sampler, p, k3, in3 );
+					for( size_t d=0; d<3; d++ ) {
+						#pragma omp simd
+						for( size_t l=0; l<W; l++ ) p[d][l] = x[d][l] + h * k3[d][l];
+					}
+					Lanes::template sample< W >( sampler, p, k4, in4 );
+					for( size_t d=0; d<3; d++ ) {
+						#pragma omp simd
+						for( size_t l=0; l<W; l++ ) p[d][l] = x[d][l] + ( h / 6 ) * ( k1[d][l] + 2 * k2[d][l] + 2 * k3[d][l] + k4[d][l] );
+					}
+
+					// masked lanes: ended lines are finished, sliced ones continued later
+					const bool aborted = abortFlag && *abortFlag;
+					for( size_t l=0; l<W; l++ ) {
+						if( !active[l] ) continue;
+						bool ended = !( in1[l] && in2[l] && in3[l] && in4[l] );
+						if( !ended ) {
+							for( size_t d=0; d<3; d++ ) x[d][l] = p[d][l];
+							const double position[3] = { x[0][l], x[1][l], x[2][l] };
+							sink( line[l].seed, position );
+							total++;
+							slice[l]++;
+							ended = ++line[l].steps >= maxSteps || aborted;
+						}
+						if( ended ) {
+							pool.finish();
+						} else if( slice[l] >= sliceSteps ) {
+							for( size_t d=0; d<3; d++ ) line[l].x[d] = x[d][l];
+							pool.resume( thread, line[l] );
+						} else {
+							continue;
+						}
+						active[l] = false;
+						numActive--;
+					}
+
+					if( thread == 0 && std::chrono::steady_clock::now() - reported > std::chrono::milliseconds( 500 ) ) {
+						progress( pool.finished(), pool.size() );
+						reported = std::chrono::steady_clock::now();
+					}
+				}
+				return total;
+			}
+
+#ifdef PACKETINTEGRATION_X86
+			// flatten inlines the whole kernel, so that it is compiled for the target as well
+			template< typename Sampler, typename Sink, typename Progress >
+			__attribute__(( target( "avx512f" ), flatten ))
+			inline size_t runPacketsRK4AVX512( const Sampler& sampler, TaskPool< PacketLine >& pool, size_t thread, double h, size_t maxSteps,
+											   size_t sliceSteps, AbortFlag abortFlag, Sink& sink, Progress& progress ) {
+				return runPacketsRK4< 16, AVX512Lanes >( sampler, pool, thread, h, maxSteps, sliceSteps, abortFlag, sink, progress );
+			}
+
+			template< typename Sampler, typename Sink, typename Progress >
+			__attribute__(( target( "avx2" ), flatten ))
+			inline size_t runPacketsRK4AVX2( const Sampler& sampler, TaskPool< PacketLine >& pool, size_t thread, double h, size_t maxSteps,
+											 size_t sliceSteps, AbortFlag abortFlag, Sink& sink, Progress& progress ) {
+				return runPacketsRK4< 8, AVX2Lanes >( sampler, pool, thread, h, maxSteps, sliceSteps, abortFlag, sink, progress );
+			}
+#endif
+
+			template< typename Sampler, typename Sink, typename Progress >
+			inline size_t runPacketsRK4Default( const Sampler& sampler, TaskPool< PacketLine >& pool, size_t thread, double h, size_t maxSteps,
+												size_t sliceSteps, AbortFlag abortFlag, Sink& sink, Progress& progress ) {
+				return runPacketsRK4< 4, DefaultLanes >( sampler, pool, thread, h, maxSteps, sliceSteps, abortFlag, sink, progress );
+			}
+		}
+
+		/// Instruction sets of the packet kernels. Best picks the widest one the CPU has, one it
+		/// lacks falls back to the next narrower one.
+		enum class PacketIsa {
+			Best,
+			Default,	///< 4 lanes with the instructions the build targets
+			AVX2,		///< 8 lanes
+			AVX512		///< 16 lanes
+		};
+
+		/// Integrates a line with RK4 from every seed (x y z interleaved) on a uniform field, like
+		/// integrateLine with RK4 and a StepLimit, but advances a packet of seeds per thread in
+		/// lockstep in SIMD lanes. sink( seed, x ) receives every new position, concurrently for
+		/// different seeds. The lines go through a TaskPool like those of integrateLines: a line
+		/// leaves its lane as a continuation after sliceSteps steps, and progress( finished, total )
+		/// is called from one thread about twice a second. Requires supportsPackets( field ).
+		/// Returns the number of steps.
+		template< typename Sink, typename Progress >
+		inline size_t integratePacketsRK4( const StructuredVectorField& field, const std::vector< double >& seeds, double stepSize, size_t maxSteps,
+										   AbortFlag abortFlag, Sink& sink, Progress progress, PacketIsa isa = PacketIsa::Best, size_t sliceSteps = 256 ) {
+#ifdef PACKETINTEGRATION_X86
+			static const bool hasAVX512 = __builtin_cpu_supports( "avx512f" );
+			static const bool hasAVX2 = __builtin_cpu_supports( "avx2" );
+			if( isa == PacketIsa::Best ) isa = PacketIsa::AVX512;
+			if( isa == PacketIsa::AVX512 && !hasAVX512 ) isa = PacketIsa::AVX2;
+			if( isa == PacketIsa::AVX2 && !hasAVX2 ) isa = PacketIsa::Default;
+#else
+			isa = PacketIsa::Default;
+#endif
+
+			std::vector< detail::PacketLine > lines( seeds.size() / 3 );
+			for( size_t i=0; i<lines.size(); i++ ) {
+				lines[i].seed = i;
+				for( size_t d=0; d<3; d++ ) lines[i].x[d] = seeds[3*i+d];
+				lines[i].steps = 0;
+			}
+			if( lines.empty() || maxSteps == 0 ) return 0;
+
+			// neighbouring seeds are dealt to the same thread a packet at a time, so that a
+			// packet starts out sampling the same cells
+			const size_t numThreads = std::max( omp_get_max_threads(), 1 );
+			TaskPool< detail::PacketLine > pool( numThreads, std::move( lines ), 16 );
+			auto run = [&]( const auto& sampler ) {
+				size_t total = 0;
+				#pragma omp parallel num_threads( numThreads ) reduction( + : total )
+				{
+					const size_t thread = omp_get_thread_num();
+#ifdef PACKETINTEGRATION_X86
+					if( isa == PacketIsa::AVX512 ) total += detail::runPacketsRK4AVX512( sampler, pool, thread, stepSize, maxSteps, sliceSteps, abortFlag, sink, progress );
+					else if( isa == PacketIsa::AVX2 ) total += detail::runPacketsRK4AVX2( sampler, pool, thread, stepSize, maxSteps, sliceSteps, abortFlag, sink, progress );
+					else
+#endif
+					total += detail::runPacketsRK4Default( sampler, pool, thread, stepSize, maxSteps, sliceSteps, abortFlag, sink, progress );
+				}
+				return total;
+			};
+			if( field.singlePrecision() ) return run( detail::UniformSampler< float >( field ) );
+			return run( detail::UniformSampler< double >( field ) );
+		}
+	}
+}
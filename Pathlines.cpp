@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <fantom/algorithm.hpp>
+#include <fantom/register.hpp>
+#include <fantom/fields.hpp>
+#include <fantom/datastructures/LineSet.hpp>
+
+#include "IntegrationFields.hpp"
+#include "LineSets.hpp"
+#include "TimeSeries.hpp"
+#include "UnsteadyIntegration.hpp"
+#include "VTKFields.hpp"
+#include "VTKFile.hpp"
+
+using namespace fantom;
+
+namespace {
+
+	// Samples the field of one time step, through its lattice where it has one. One instance per thread.
+	class StepField {
+
+	public:
+		StepField( const TensorFieldInterpolated< 3, Vector3 >& field, const std::shared_ptr< const StructuredVectorField >& structured ) {
+			if( structured ) m_hinted.emplace( *structured );
+			else m_evaluated.emplace( field );
+		}
+
+		bool operator()( const Point3& x, Vector3& v ) {
+			return m_hinted ? ( *m_hinted )( x, v ) : ( *m_evaluated )( x, v );
+		}
+
+	private:
+		std::optional< HintedField > m_hinted;
+		std::optional< EvaluatorField > m_evaluated;
+	};
+
+	class Pathlines : public DataAlgorithm {
+
+		std::string m_pattern;
+		bool m_detectRegular;
+		bool m_singlePrecision;
+		bool m_useCache;
+		std::unique_ptr< TimeSeries< VtkFieldData > > m_series;
+
+		// one of the two time steps the particles are between
+		struct Step {
+			size_t index = size_t( -1 );
+			std::shared_ptr< const VtkFieldData > data;
+			std::shared_ptr< const TensorFieldInterpolated< 3, Vector3 > > field;
+			std::shared_ptr< const StructuredVectorField > structured;
+		};
+		Step m_window[2];
+
+	public:
+		struct Options : public DataAlgorithm::Options {
+			Options( fantom::Options::Control& control ) :
+				DataAlgorithm::Options( control )
+			{
+				add< std::string >( "Files", "File pattern like /data/run_*.vtk or a .pvd collection", "" );
+				add< int >( "Memory budget", "Memory for cached time steps in MB", 1024 );
+				add< bool >( "Single precision", "Store coordinates and values as 32 bit floats, so that twice as many steps fit into the budget", false );
+				add< bool >( "Detect regular grids", "Store axis-aligned grids as uniform or rectilinear domains", true );
+				add< bool >( "Use cache", "Keep a binary copy of every parsed legacy file next to it and reuse it while the file is unchanged", false );
+				add< LineSet >( "Seed line", "Starting points" );
+				add< InputChoices >( "Algorithm", "Choose an integration algorithm", std::vector< std::string >{ "Euler", "Heun", "Runge-Kutta" }, "Runge-Kutta" );
+				add< InputChoices >( "Lines", "Pathlines follow the particle from a seed, streaklines connect all particles released at a seed", std::vector< std::string >{ "Pathlines", "Streaklines" }, "Pathlines" );
+				add< float >( "Start time", "Time the particles start at", 0.0 );
+				add< float >( "Duration", "Time the particles are followed for", 1.0 );
+				add< float >( "Step size", "Largest integration time step", 0.01 );
+				add< float >( "Release interval", "Time between the particles of a streakline, 0 releases one at every time step of the data", 0.0 );
+			}
+		};
+
+		struct DataOutputs : public DataAlgorithm::DataOutputs {
+			DataOutputs( fantom::DataOutputs::Control& control ) :
+				DataAlgorithm::DataOutputs( control )
+			{
+				add< LineSet >( "Lines" );
+			}
+		};
+
+		Pathlines( InitData& data ) :
+			DataAlgorithm( data ),
+			m_detectRegular( true ),
+			m_singlePrecision( false ),
+			m_useCache( false )
+		{
+
+		}
+
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
+			std::string pattern = options.get< std::string >( "Files" );
+			if( pattern == "" ) {
+				infoLog() << "No input files were selected!" << std::endl;
+				return;
+			}
+			std::shared_ptr< const LineSet > seedLine = options.get< const LineSet >( "Seed line" );
+			if( !seedLine ) {
+				infoLog() << "No input seedline!" << std::endl;
+				return;
+			}
+			integration::Method method;
+			if( !integration::parseMethod( options.get< std::string >( "Algorithm" ), method ) ) return;
+			size_t budget = size_t( std::max( options.get< int >( "Memory budget" ), 0 ) ) << 20;
+			bool detectRegular = options.get< bool >( "Detect regular grids" );
+			bool singlePrecision = options.get< bool >( "Single precision" );
+			bool useCache = options.get< bool >( "Use cache" );
+
+			// index the series once, the files themselves are only read when the particles get there
+			if( !m_series || pattern != m_pattern || detectRegular != m_detectRegular || singlePrecision != m_singlePrecision || useCache != m_useCache ) {
+				m_series.reset();
+				std::vector< TimeStep > steps;
+				std::string error;
+				if( !indexVtkSeries( pattern, steps, error ) ) {
+					infoLog() << error << std::endl;
+					return;
+				}
+				debugLog() << "Indexed " << steps.size() << " time steps" << std::endl;
+				// the lattice copy the particles sample is made with the step, so that the budget
+				// counts it as well; it lives as long as the step's field
+				Precision precision = singlePrecision ? Precision::FLOAT32 : Precision::FLOAT64;
+				VtkReadOptions read;
+				read.useCache = useCache;
+				m_series.reset( new TimeSeries< VtkFieldData >( steps, [detectRegular, precision, read]( const TimeStep& step, size_t& bytes, std::string& error ) {
+					std::shared_ptr< const VtkFieldData > data = loadVtkFieldData( step.path, detectRegular, precision, read, bytes, error );
+					if( data && !data->fields.empty() ) {
+						std::shared_ptr< const StructuredVectorField > structured = structuredVectorField( std::dynamic_pointer_cast< const TensorFieldInterpolated< 3, Vector3 > >( data->fields[0] ) );
+						if( structured ) bytes += structured->memoryUsed() + structured->grid().memoryUsed();
+					}
+					return data;
+				}, budget ) );
+				m_pattern = pattern;
+				m_detectRegular = detectRegular;
+				m_singlePrecision = singlePrecision;
+				m_useCache = useCache;
+			}
+			m_series->setBudget( budget );
+
+			std::vector< double > times;
+			for( const TimeStep& step : m_series->steps() ) times.push_back( step.time );
+			double start = options.get< float >( "Start time" );
+			double end = start + options.get< float >( "Duration" );
+			if( times.size() < 2 || start < times.front() || start >= times.back() ) {
+				infoLog() << "Start time outside of the time steps" << std::endl;
+				return;
+			}
+
+			std::vector< Point3 > seeds( seedLine->getNumPoints() );
+			for( size_t i=0; i<seeds.size(); i++ ) {
+				seeds[i] = seedLine->getPoint( i );
+			}
+
+			// the window slides forward, so the later step of the last window is the earlier one now
+			auto setWindow = [this]( size_t index ) {
+				if( m_window[1].index == index ) m_window[0] = std::move( m_window[1] );
+				if( m_window[0].index != index && !load( index, m_window[0] ) ) return false;
+				return load( index + 1, m_window[1] );
+			};
+			auto makeStepField = [this]( size_t slot ) {
+				return StepField( *m_window[slot].field, m_window[slot].structured );
+			};
+
+			integration::ParticleLines lines = options.get< std::string >( "Lines" ) == "Streaklines" ? integration::ParticleLines::Streaklines : integration::ParticleLines::Pathlines;
+			double stepSize = options.get< float >( "Step size" );
+			double releaseInterval = std::max( options.get< float >( "Release interval" ), 0.0f );
+			std::vector< Point3 > vertices;
+			std::vector< size_t > offsets;
+			integration::ParticleStats stats;
+			auto advect = [&]( auto makeStepper ) {
+				stats = integration::advectParticles( lines, seeds, times, start, end, stepSize, releaseInterval, &abortFlag, makeStepper, setWindow, makeStepField, vertices, offsets );
+			};
+			switch( method ) {
+			case integration::Method::Euler:
+				advect( []( double h ) { return integration::Euler< SpaceTime< Vector3 > >( h ); } );
+				break;
+			case integration::Method::Heun:
+				advect( []( double h ) { return integration::Heun< SpaceTime< Vector3 > >( h ); } );
+				break;
+			default:
+				advect( []( double h ) { return integration::RK4< SpaceTime< Vector3 > >( h ); } );
+				break;
+			}
+
+			// keep nothing resident between runs beyond the series' cache
+			m_window[0] = Step();
+			m_window[1] = Step();
+			if( abortFlag ) return;
+
+			infoLog() << stats.particles << " particles in " << stats.steps << " steps through " << stats.windows << " pairs of time steps" << std::endl;
+			if( stats.time < end ) infoLog() << "Stopped at time " << stats.time << ", the data or a time step ended" << std::endl;
+			debugLog() << "Cached " << ( m_series->memoryUsed() >> 20 ) << " MB of time steps" << std::endl;
+
+			std::shared_ptr< LineSet > result = makeLineSet( vertices, offsets );
+			setResult( "Lines", result );
+		}
+
+	private:
+		// Makes time step index resident in step, which also prefetches the one after it.
+		bool load( size_t index, Step& step ) {
+			if( step.index == index ) return true;
+			step = Step();
+			std::shared_ptr< const VtkFieldData > data = m_series->get( index );
+			if( !data ) {
+				infoLog() << "Failed to load " << m_series->steps()[index].path << ": " << m_series->error( index ) << std::endl;
+				return false;
+			}
+			std::shared_ptr< const TensorFieldInterpolated< 3, Vector3 > > field = std::dynamic_pointer_cast< const TensorFieldInterpolated< 3, Vector3 > >( data->fields[0] );
+			if( !field ) {
+				infoLog() << "Time step " << index << " has no vector field" << std::endl;
+				return false;
+			}
+			step.index = index;
+			step.data = data;
+			step.field = field;
+			step.structured = structuredVectorField( field );
+			return true;
+		}
+
+	};
+
+	AlgorithmRegister< Pathlines > reg( "VisPraktikum/Pathlines", "Pathlines and streaklines through the time steps of an unsteady VTK dataset" );
+
+}
@@ -4,6 +4,7 @@
 #include <fantom/fields.hpp>
 
 #include "Integrator.cpp"
+#include "PacketIntegration.hpp"
 
 using namespace fantom;
 
@@ -12,6 +13,13 @@ namespace {
 	class RungeKutta : public Integrator {
 
 	public:
+		struct Options : public Integrator::Options {
+			Options( fantom::Options::Control& control ) :
+				Integrator::Options( control )
+			{
+				add< bool >( "Packets", "Integrate several seeds at once in SIMD lanes on uniform grids", true );
+			}
+		};
 
 		RungeKutta( InitData& data ) :
 			Integrator( data )
@@ -25,51 +33,44 @@ namespace {
 
 			// check seedline vs grid bounding box
 			m_numPoints = m_seedLine->getNumPoints();
-			if( m_grid->index( m_grid->locate( m_seedLine->getPointOnLine( 0, 0 ) ) ) == 0 ||
-				m_grid->index( m_grid->locate( m_seedLine->getPointOnLine( 0, m_numPoints-1 ) ) ) == 0 )
+			if( !insideGrid( m_grid, m_seedLine->getPointOnLine( 0, 0 ) ) ||
+				!insideGrid( m_grid, m_seedLine->getPointOnLine( 0, m_numPoints-1 ) ) )
 			{
 				infoLog() << "Seed points out of bounds" << std::endl;
 				return;
 			}
 
-			std::vector< Point3 > startingPoints( m_numPoints );
-			for( int i=0; i<m_numPoints; i++ ) {
-				startingPoints[i] = m_seedLine->getPoint( i );
-				m_vertices.push_back( std::vector< Point3 >() );
+			integration::RK4< Vector3 > stepper( m_stepSize );
+			// packets can't end single lines near others, evenly-spaced lines are integrated one by one
+			if( options.get< bool >( "Packets" ) && m_separation <= 0.0 ) {
+				integrateCached( "RK4 packets", abortFlag, [&]( const std::vector< Point3 >& seeds, LineArena< Point3 >& arena ) {
+					std::shared_ptr< const StructuredVectorField > structured = structuredVectorField( m_field );
+					if( structured && integration::supportsPackets( *structured ) ) integratePackets( *structured, seeds, arena, abortFlag );
+					else integrateSeeds( stepper, false, abortFlag, seeds, arena, structured );
+				} );
+			} else {
+				integrate( stepper, false, abortFlag );
 			}
 
-			#pragma omp parallel for
-			for( int i=0; i<startingPoints.size(); i++ ) {
-				auto evaluator = m_field->makeEvaluator();
-				while( m_grid->index( m_grid->locate( startingPoints[i] ) ) != 0 ) {
-					m_vertices[i].push_back( startingPoints[i] );
-
-					Vector3 q1, q2, q3, q4;
-
-					//	q1
-					if( !evaluator->reset( startingPoints[i] ) ) break;
-					q1 = evaluator->value();
-
-					// q2
-					if( !evaluator->reset( startingPoints[i] + ( m_stepSize / 2 ) * q1 ) ) break;
-					q2 = evaluator->value();
-
-					// q3
-					if( !evaluator->reset( startingPoints[i] + ( m_stepSize / 2 ) * q2 ) ) break;;
-					q3 = evaluator->value();
-
-					// q4
-					if( !evaluator->reset( startingPoints[i] + m_stepSize * q3 ) ) break;
-					q4 = evaluator->value();
-
-					// n+1			  = ...
-					startingPoints[i] = startingPoints[i] + ( m_stepSize / 6 ) * ( q1 + 2*q2 + 2*q3 + q4 );
+			Integrator::makeLineSet( options );
+		}
 
-					m_vertices[i].push_back( startingPoints[i] );
-				}
+	private:
+		// Same lines as integrateSeeds with RK4, but the seeds advance in lockstep in SIMD packets.
+		void integratePackets( const StructuredVectorField& field, const std::vector< Point3 >& seeds, LineArena< Point3 >& arena, const volatile bool& abortFlag ) {
+			std::vector< double > coordinates( 3 * seeds.size() );
+			for( size_t i=0; i<seeds.size(); i++ ) {
+				for( size_t d=0; d<3; d++ ) coordinates[3*i+d] = seeds[i][d];
 			}
 
-			Integrator::makeLineSet( options );
+			// a seed is in one lane at a time, so its line is only written by one thread
+			auto sink = [&arena]( size_t seed, const double x[3] ) {
+				arena.push( seed, Point3( x[0], x[1], x[2] ) );
+			};
+			auto progress = [this]( size_t finished, size_t total ) {
+				debugLog() << "Integrated " << finished << " of " << total << " streamlines" << std::endl;
+			};
+			integration::integratePacketsRK4( field, coordinates, m_stepSize, m_maxSteps, &abortFlag, sink, progress );
 		}
 
 	};
@@ -0,0 +1,72 @@
+#include <fantom/algorithm.hpp>
+#include <fantom/register.hpp>
+#include <fantom/fields.hpp>
+#include <fantom/datastructures/LineSet.hpp>
+
+#include "LineSets.hpp"
+#include "LineSimplification.hpp"
+
+using namespace fantom;
+
+namespace {
+
+	class SimplifyLines : public DataAlgorithm {
+
+	public:
+		struct Options : public DataAlgorithm::Options {
+			Options( fantom::Options::Control& control ) :
+				DataAlgorithm::Options( control )
+			{
+				add< LineSet >( "Lines", "Lines to simplify" );
+				add< float >( "Tolerance", "Drop vertices closer than this to the simplified line", 0.01 );
+			}
+		};
+
+		struct DataOutputs : public DataAlgorithm::DataOutputs {
+			DataOutputs( fantom::DataOutputs::Control& control ) :
+				DataAlgorithm::DataOutputs( control )
+			{
+				add< LineSet >( "Simplified lines" );
+			}
+		};
+
+		SimplifyLines( InitData& data ) :
+			DataAlgorithm( data )
+		{
+
+		}
+
+		virtual void execute( const Algorithm::Options& options, const volatile bool& abortFlag ) override {
+			std::shared_ptr< const LineSet > lines = options.get< LineSet >( "Lines" );
+			if( !lines ) {
+				infoLog() << "No input lines!" << std::endl;
+				return;
+			}
+
+			// flat copy of all lines, line i from offsets[i] to offsets[i+1]
+			const std::vector< std::vector< size_t > >& indices = lines->getLines();
+			std::vector< size_t > offsets( indices.size() + 1, 0 );
+			for( size_t i=0; i<indices.size(); i++ ) {
+				offsets[i+1] = offsets[i] + indices[i].size();
+			}
+			std::vector< Point3 > vertices( offsets.back() );
+			#pragma omp parallel for schedule( dynamic, 64 )
+			for( long long i=0; i<(long long)indices.size(); i++ ) {
+				for( size_t j=0; j<indices[i].size(); j++ ) {
+					vertices[ offsets[i] + j ] = lines->getPoint( indices[i][j] );
+				}
+			}
+			if( abortFlag ) return;
+
+			SimplifyStats stats = simplifyLines( vertices, offsets, options.get< float >( "Tolerance" ) );
+			if( abortFlag ) return;
+			infoLog() << "Simplified " << stats.inputVertices << " to " << stats.outputVertices << " vertices (" << stats.reduction() << "x), max deviation " << stats.maxDeviation << std::endl;
+
+			setResult( "Simplified lines", makeLineSet( vertices, offsets ) );
+		}
+
+	};
+
+	AlgorithmRegister< SimplifyLines > reg( "VisPraktikum/SimplifyLines", "Removes nearly collinear vertices from lines (Douglas-Peucker)" );
+
+}
@@ -0,0 +1,465 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "CellLocator.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace fantom
+{
+
+	/// How the points of a structured grid are placed.
+	enum class GridLayout {
+		Curvilinear,	///< arbitrary hexahedra
+		Rectilinear,	///< axis-aligned with one coordinate array per axis
+		Uniform			///< axis-aligned and equally spaced
+	};
+
+	/// Structured hexahedral grid with point (i,j,k) at index i + nx * ( j + ny * k ). Point
+	/// location starts at a cell hint and walks through neighbouring cells, which is cheap while
+	/// a streamline advances through the grid. Without a hint or when the walk fails, curvilinear
+	/// grids look the point up in a CellLocator, built on the first such lookup.
+	class StructuredGrid {
+
+	public:
+		/// No cell, e.g. a hint before the first location.
+		static const size_t none = size_t( -1 );
+
+		/// Builds the grid from point coordinates and detects an axis-aligned layout.
+		StructuredGrid( const size_t dims[3], std::vector< double > x, std::vector< double > y, std::vector< double > z ) :
+			m_layout( GridLayout::Curvilinear )
+		{
+			for( size_t d=0; d<3; d++ ) m_dims[d] = dims[d];
+			m_points[0].swap( x );
+			m_points[1].swap( y );
+			m_points[2].swap( z );
+			detectLayout();
+		}
+
+		size_t dim( size_t d ) const {
+			return m_dims[d];
+		}
+
+		size_t numPoints() const {
+			return m_dims[0] * m_dims[1] * m_dims[2];
+		}
+
+		size_t numCells() const {
+			return ( m_dims[0] - 1 ) * ( m_dims[1] - 1 ) * ( m_dims[2] - 1 );
+		}
+
+		GridLayout layout() const {
+			return m_layout;
+		}
+
+		size_t pointIndex( size_t i, size_t j, size_t k ) const {
+			return i + m_dims[0] * ( j + m_dims[1] * k );
+		}
+
+		size_t cellIndex( size_t i, size_t j, size_t k ) const {
+			return i + ( m_dims[0] - 1 ) * ( j + ( m_dims[1] - 1 ) * k );
+		}
+
+		void cellCoordinates( size_t cell, size_t c[3] ) const {
+			c[0] = cell % ( m_dims[0] - 1 );
+			cell /= m_dims[0] - 1;
+			c[1] = cell % ( m_dims[1] - 1 );
+			c[2] = cell / ( m_dims[1] - 1 );
+		}
+
+		/// Coordinate d of point index.
+		double point( size_t index, size_t d ) const {
+			if( m_layout == GridLayout::Curvilinear ) return m_points[d][index];
+			size_t stride = d == 0 ? 1 : d == 1 ? m_dims[0] : m_dims[0] * m_dims[1];
+			return m_axes[d][ index / stride % m_dims[d] ];
+		}
+
+		/// Finds the cell containing p and its local coordinates in [0,1]^3. cell is the hint on
+		/// input, none if there is none, and the result on output. Returns false if p lies outside.
+		bool locate( const double p[3], size_t& cell, double local[3] ) const {
+			size_t c[3] = { 0, 0, 0 };
+			if( cell != none && cell < numCells() ) cellCoordinates( cell, c );
+			else cell = none;
+			return locate( p, cell, c, local );
+		}
+
+		/// Same as above with the lattice coordinates c of cell carried along, which saves
+		/// converting between both for every location. c has to match cell unless cell is none.
+		bool locate( const double p[3], size_t& cell, size_t c[3], double local[3] ) const {
+			if( m_layout == GridLayout::Uniform ) {
+				for( size_t d=0; d<3; d++ ) {
+					double u = ( p[d] - m_origin[d] ) * m_inverseSpacing[d];
+					if( m_dims[d] < 2 || !( u >= 0.0 && u <= m_dims[d] - 1 ) ) return false;
+					c[d] = std::min< size_t >( size_t( u ), m_dims[d] - 2 );
+					local[d] = u - c[d];
+				}
+				cell = cellIndex( c[0], c[1], c[2] );
+				return true;
+			}
+			return locateNonUniform( p, cell, c, local );
+		}
+
+		/// Whether cell contains p, with its local coordinates in local.
+		bool contains( size_t cell, const double p[3], double local[3] ) const {
+			if( m_layout != GridLayout::Curvilinear ) {
+				size_t found = none, c[3];
+				return locate( p, found, c, local ) && found == cell;
+			}
+			size_t c[3];
+			cellCoordinates( cell, c );
+			if( !localCoordinates( c, p, local ) ) return false;
+			for( size_t d=0; d<3; d++ ) {
+				if( local[d] < -s_epsilon || local[d] > 1.0 + s_epsilon ) return false;
+			}
+			for( size_t d=0; d<3; d++ ) local[d] = std::min( std::max( local[d], 0.0 ), 1.0 );
+			return true;
+		}
+
+		/// Axes of axis-aligned grids.
+		const std::vector< double >& axis( size_t d ) const {
+			return m_axes[d];
+		}
+
+		/// First point and distance of points along axis d of uniform grids.
+		double origin( size_t d ) const {
+			return m_origin[d];
+		}
+
+		double spacing( size_t d ) const {
+			return m_spacing[d];
+		}
+
+		/// Bytes of the copied coordinates, without the cell locator, which is built on first use.
+		size_t memoryUsed() const {
+			size_t bytes = 0;
+			for( size_t d=0; d<3; d++ ) bytes += ( m_points[d].size() + m_axes[d].size() ) * sizeof( double );
+			return bytes;
+		}
+
+	private:
+		size_t m_dims[3];
+		GridLayout m_layout;
+		std::vector< double > m_points[3];
+		std::vector< double > m_axes[3];
+		double m_origin[3];
+		double m_spacing[3];
+		double m_inverseSpacing[3];
+		mutable std::once_flag m_locatorBuilt;
+		mutable CellLocator m_locator;
+
+		static constexpr double s_epsilon = 1e-9;
+		static const size_t s_maxWalk = 64;
+
+		void detectLayout() {
+			for( size_t d=0; d<3; d++ ) {
+				m_axes[d].resize( m_dims[d] );
+				size_t stride = d == 0 ? 1 : d == 1 ? m_dims[0] : m_dims[0] * m_dims[1];
+				for( size_t i=0; i<m_dims[d]; i++ ) m_axes[d][i] = m_points[d][ i * stride ];
+			}
+
+			// every point has to lie on the lattice spanned by the axes
+			double eps[3];
+			for( size_t d=0; d<3; d++ ) {
+				auto range = std::minmax_element( m_axes[d].begin(), m_axes[d].end() );
+				eps[d] = 1e-6 * std::max( *range.second - *range.first, 1e-30 );
+				for( size_t i=1; i<m_dims[d]; i++ ) {
+					if( !( m_axes[d][i] > m_axes[d][i-1] ) ) return;
+				}
+			}
+			for( size_t k=0; k<m_dims[2]; k++ ) {
+				for( size_t j=0; j<m_dims[1]; j++ ) {
+					for( size_t i=0; i<m_dims[0]; i++ ) {
+						size_t index = pointIndex( i, j, k );
+						if( std::abs( m_points[0][index] - m_axes[0][i] ) > eps[0] ||
+							std::abs( m_points[1][index] - m_axes[1][j] ) > eps[1] ||
+							std::abs( m_points[2][index] - m_axes[2][k] ) > eps[2] ) return;
+					}
+				}
+			}
+
+			// axis-aligned grids don't need the point coordinates any more
+			for( size_t d=0; d<3; d++ ) std::vector< double >().swap( m_points[d] );
+			m_layout = GridLayout::Uniform;
+			for( size_t d=0; d<3; d++ ) {
+				size_t n = m_dims[d];
+				m_origin[d] = m_axes[d][0];
+				m_spacing[d] = n > 1 ? ( m_axes[d][n-1] - m_axes[d][0] ) / ( n - 1 ) : 1.0;
+				m_inverseSpacing[d] = 1.0 / m_spacing[d];
+				for( size_t i=0; i<n; i++ ) {
+					if( std::abs( m_origin[d] + i * m_spacing[d] - m_axes[d][i] ) > eps[d] ) m_layout = GridLayout::Rectilinear;
+				}
+			}
+		}
+
+		bool locateNonUniform( const double p[3], size_t& cell, size_t c[3], double local[3] ) const {
+			if( m_layout == GridLayout::Rectilinear ) {
+				for( size_t d=0; d<3; d++ ) {
+					const std::vector< double >& axis = m_axes[d];
+					const size_t n = m_dims[d];
+					if( n < 2 || !( p[d] >= axis[0] && p[d] <= axis[n-1] ) ) return false;
+					if( cell == none || !( p[d] >= axis[ c[d] ] && p[d] <= axis[ c[d] + 1 ] ) ) {
+						c[d] = std::min< size_t >( std::upper_bound( axis.begin(), axis.end(), p[d] ) - axis.begin() - 1, n - 2 );
+					}
+					local[d] = ( p[d] - axis[ c[d] ] ) / ( axis[ c[d] + 1 ] - axis[ c[d] ] );
+				}
+				cell = cellIndex( c[0], c[1], c[2] );
+				return true;
+			}
+
+			if( cell != none ) {
+				size_t walked[3] = { c[0], c[1], c[2] };
+				if( walk( p, walked, local ) ) {
+					for( size_t d=0; d<3; d++ ) c[d] = walked[d];
+					cell = cellIndex( c[0], c[1], c[2] );
+					return true;
+				}
+			}
+			std::call_once( m_locatorBuilt, [this]() { buildLocator(); } );
+			size_t found = m_locator.find( p, [&]( size_t candidate ) { return contains( candidate, p, local ); } );
+			if( found == none ) return false;
+			cell = found;
+			cellCoordinates( cell, c );
+			return true;
+		}
+
+		void buildLocator() const {
+			m_locator = CellLocator( numCells(), [this]( size_t cell, double lower[3], double upper[3] ) {
+				size_t c[3];
+				cellCoordinates( cell, c );
+				for( size_t d=0; d<3; d++ ) {
+					lower[d] = HUGE_VAL;
+					upper[d] = -HUGE_VAL;
+				}
+				for( size_t v=0; v<8; v++ ) {
+					size_t index = pointIndex( c[0] + ( v & 1 ), c[1] + ( ( v >> 1 ) & 1 ), c[2] + ( v >> 2 ) );
+					for( size_t d=0; d<3; d++ ) {
+						lower[d] = std::min( lower[d], m_points[d][index] );
+						upper[d] = std::max( upper[d], m_points[d][index] );
+					}
+				}
+				// the local coordinates of a contained point may overshoot by s_epsilon
+				for( size_t d=0; d<3; d++ ) {
+					double margin = s_epsilon * ( upper[d] - lower[d] );
+					lower[d] -= margin;
+					upper[d] += margin;
+				}
+			} );
+		}
+
+		// Walks from cell c towards p. On success c contains p.
+		bool walk( const double p[3], size_t c[3], double local[3] ) const {
+			for( size_t n=0; n<s_maxWalk; n++ ) {
+				if( !localCoordinates( c, p, local ) ) return false;
+
+				// step into the neighbour across the face that p lies furthest behind
+				size_t axis = 3;
+				double worst = s_epsilon;
+				for( size_t d=0; d<3; d++ ) {
+					double outside = std::max( -local[d], local[d] - 1.0 );
+					if( outside > worst ) {
+						worst = outside;
+						axis = d;
+					}
+				}
+				if( axis == 3 ) {
+					for( size_t d=0; d<3; d++ ) local[d] = std::min( std::max( local[d], 0.0 ), 1.0 );
+					return true;
+				}
+				if( local[axis] < 0.0 ) {
+					if( c[axis] == 0 ) return false;
+					c[axis]--;
+				} else {
+					if( c[axis] + 2 >= m_dims[axis] ) return false;
+					c[axis]++;
+				}
+			}
+			return false;
+		}
+
+		// Inverts the trilinear map of cell c with Newton's method.
+		bool localCoordinates( const size_t c[3], const double p[3], double local[3] ) const {
+			double corner[8][3];
+			for( size_t v=0; v<8; v++ ) {
+				size_t index = pointIndex( c[0] + ( v & 1 ), c[1] + ( ( v >> 1 ) & 1 ), c[2] + ( v >> 2 ) );
+				for( size_t d=0; d<3; d++ ) corner[v][d] = m_points[d][index];
+			}
+
+			double u[3] = { 0.5, 0.5, 0.5 };
+			for( size_t iteration=0; iteration<16; iteration++ ) {
+				double x[3] = { 0.0, 0.0, 0.0 };
+				double jacobian[3][3] = {};
+				for( size_t v=0; v<8; v++ ) {
+					double w[3], dw[3];
+					for( size_t a=0; a<3; a++ ) {
+						bool upper = ( v >> a ) & 1;
+						w[a] = upper ? u[a] : 1.0 - u[a];
+						dw[a] = upper ? 1.0 : -1.0;
+					}
+					double weight = w[0] * w[1] * w[2];
+					double derivative[3] = { dw[0] * w[1] * w[2], w[0] * dw[1] * w[2], w[0] * w[1] * dw[2] };
+					for( size_t d=0; d<3; d++ ) {
+						x[d] += weight * corner[v][d];
+						for( size_t a=0; a<3; a++ ) jacobian[d][a] += derivative[a] * corner[v][d];
+					}
+				}
+
+				double r[3] = { p[0] - x[0], p[1] - x[1], p[2] - x[2] };
+				double delta[3];
+				if( !solve( jacobian, r, delta ) ) return false;
+				for( size_t a=0; a<3; a++ ) u[a] += delta[a];
+				if( std::abs( delta[0] ) + std::abs( delta[1] ) + std::abs( delta[2] ) < 1e-12 ) break;
+				// far outside of this cell, the direction is good enough for walking
+				if( std::abs( u[0] - 0.5 ) > 4.0 || std::abs( u[1] - 0.5 ) > 4.0 || std::abs( u[2] - 0.5 ) > 4.0 ) break;
+			}
+			for( size_t a=0; a<3; a++ ) local[a] = u[a];
+			return std::isfinite( u[0] ) && std::isfinite( u[1] ) && std::isfinite( u[2] );
+		}
+
+		// Solves a x = b with Cramer's rule.
+		static bool solve( const double a[3][3], const double b[3], double x[3] ) {
+			double det =
+				a[0][0] * ( a[1][1] * a[2][2] - a[1][2] * a[2][1] ) -
+				a[0][1] * ( a[1][0] * a[2][2] - a[1][2] * a[2][0] ) +
+				a[0][2] * ( a[1][0] * a[2][1] - a[1][1] * a[2][0] );
+			if( std::abs( det ) < 1e-300 ) return false;
+			x[0] = ( b[0] * ( a[1][1] * a[2][2] - a[1][2] * a[2][1] ) - a[0][1] * ( b[1] * a[2][2] - a[1][2] * b[2] ) + a[0][2] * ( b[1] * a[2][1] - a[1][1] * b[2] ) ) / det;
+			x[1] = ( a[0][0] * ( b[1] * a[2][2] - a[1][2] * b[2] ) - b[0] * ( a[1][0] * a[2][2] - a[1][2] * a[2][0] ) + a[0][2] * ( a[1][0] * b[2] - b[1] * a[2][0] ) ) / det;
+			x[2] = ( a[0][0] * ( a[1][1] * b[2] - b[1] * a[2][1] ) - a[0][1] * ( a[1][0] * b[2] - b[1] * a[2][0] ) + b[0] * ( a[1][0] * a[2][1] - a[1][1] * a[2][0] ) ) / det;
+			return true;
+		}
+	};
+
+	namespace detail
+	{
+		// Trilinear interpolation of three component arrays. edges holds the indices of the lower
+		// points of the four x-edges of a cell, in the order (j,k) = (0,0), (1,0), (0,1), (1,1).
+		template< typename T >
+		inline void trilinearScalar( const T* const values[3], const size_t edges[4], const double local[3], double result[3] ) {
+			const double x = local[0], y = local[1], z = local[2];
+			const double weights[4] = { ( 1.0 - y ) * ( 1.0 - z ), y * ( 1.0 - z ), ( 1.0 - y ) * z, y * z };
+			for( size_t d=0; d<3; d++ ) {
+				const T* v = values[d];
+				double sum = 0.0;
+				for( size_t e=0; e<4; e++ ) sum += weights[e] * ( ( 1.0 - x ) * v[ edges[e] ] + x * v[ edges[e] + 1 ] );
+				result[d] = sum;
+			}
+		}
+
+#ifdef __SSE2__
+		// Both points of the x-edge starting at v as doubles.
+		inline __m128d loadEdge( const double* v ) {
+			return _mm_loadu_pd( v );
+		}
+
+		inline __m128d loadEdge( const float* v ) {
+			return _mm_cvtps_pd( _mm_castsi128_ps( _mm_loadl_epi64( reinterpret_cast< const __m128i* >( v ) ) ) );
+		}
+#endif
+
+		// Both points of an x-edge are adjacent in memory and load as one vector. SSE2 is part of
+		// every x86-64 CPU, so unlike wider instruction sets it needs no dispatch and inlines.
+		template< typename T >
+		inline void trilinear( const T* const values[3], const size_t edges[4], const double local[3], double result[3] ) {
+#ifdef __SSE2__
+			const double y = local[1], z = local[2];
+			const __m128d wx = _mm_setr_pd( 1.0 - local[0], local[0] );
+			const __m128d weights[4] = {
+				_mm_mul_pd( wx, _mm_set1_pd( ( 1.0 - y ) * ( 1.0 - z ) ) ),
+				_mm_mul_pd( wx, _mm_set1_pd( y * ( 1.0 - z ) ) ),
+				_mm_mul_pd( wx, _mm_set1_pd( ( 1.0 - y ) * z ) ),
+				_mm_mul_pd( wx, _mm_set1_pd( y * z ) )
+			};
+			for( size_t d=0; d<3; d++ ) {
+				const T* v = values[d];
+				__m128d sum = _mm_add_pd(
+					_mm_add_pd( _mm_mul_pd( loadEdge( v + edges[0] ), weights[0] ), _mm_mul_pd( loadEdge( v + edges[1] ), weights[1] ) ),
+					_mm_add_pd( _mm_mul_pd( loadEdge( v + edges[2] ), weights[2] ), _mm_mul_pd( loadEdge( v + edges[3] ), weights[3] ) ) );
+				result[d] = _mm_cvtsd_f64( _mm_add_sd( sum, _mm_unpackhi_pd( sum, sum ) ) );
+			}
+#else
+			trilinearScalar( values, edges, local, result );
+#endif
+		}
+	}
+
+	/// Vector field given at the points of a structured grid, interpolated trilinearly. The
+	/// components are stored in separate arrays, so that the x-edges of a cell load as vectors,
+	/// in double or, for data that came as 32 bit floats, in single precision.
+	class StructuredVectorField {
+
+	public:
+		/// Component d of the value at point i is values[d][i].
+		StructuredVectorField( std::shared_ptr< const StructuredGrid > grid, std::vector< double > values[3] ) :
+			m_grid( std::move( grid ) )
+		{
+			for( size_t d=0; d<3; d++ ) m_values[d].swap( values[d] );
+		}
+
+		/// Same as above with single precision values.
+		StructuredVectorField( std::shared_ptr< const StructuredGrid > grid, std::vector< float > values[3] ) :
+			m_grid( std::move( grid ) )
+		{
+			for( size_t d=0; d<3; d++ ) m_floatValues[d].swap( values[d] );
+		}
+
+		const StructuredGrid& grid() const {
+			return *m_grid;
+		}
+
+		bool singlePrecision() const {
+			return !m_floatValues[0].empty();
+		}
+
+		/// Component d of all point values, nullptr if they are stored in single precision.
+		const double* values( size_t d ) const {
+			return singlePrecision() ? nullptr : m_values[d].data();
+		}
+
+		/// Component d of all point values, nullptr if they are stored in double precision.
+		const float* floatValues( size_t d ) const {
+			return singlePrecision() ? m_floatValues[d].data() : nullptr;
+		}
+
+		size_t memoryUsed() const {
+			return 3 * ( m_values[0].size() * sizeof( double ) + m_floatValues[0].size() * sizeof( float ) );
+		}
+
+		/// Interpolates the value at local coordinates of cell.
+		template< typename V >
+		V interpolate( size_t cell, const double local[3] ) const {
+			size_t c[3];
+			m_grid->cellCoordinates( cell, c );
+			return interpolate< V >( c, local );
+		}
+
+		/// Interpolates the value at local coordinates of the cell with lattice coordinates c.
+		template< typename V >
+		V interpolate( const size_t c[3], const double local[3] ) const {
+			const size_t base = m_grid->pointIndex( c[0], c[1], c[2] );
+			const size_t dy = m_grid->dim( 0 ), dz = m_grid->dim( 0 ) * m_grid->dim( 1 );
+			const size_t edges[4] = { base, base + dy, base + dz, base + dy + dz };
+			double result[3];
+			if( singlePrecision() ) {
+				const float* const values[3] = { m_floatValues[0].data(), m_floatValues[1].data(), m_floatValues[2].data() };
+				detail::trilinear( values, edges, local, result );
+			} else {
+				const double* const values[3] = { m_values[0].data(), m_values[1].data(), m_values[2].data() };
+				detail::trilinear( values, edges, local, result );
+			}
+			return V{ result[0], result[1], result[2] };
+		}
+
+	private:
+		std::shared_ptr< const StructuredGrid > m_grid;
+		std::vector< double > m_values[3];
+		std::vector< float > m_floatValues[3];
+	};
+}
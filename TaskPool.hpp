@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "AbortFlag.hpp"
+
+namespace fantom
+{
+
+	/// Work-stealing queue for the threads of an OpenMP parallel region. Every thread has its own
+	/// deque: it takes tasks from the front and queues the continuation of an unfinished task at
+	/// the back, so all of its tasks advance before any of them is continued twice. A thread
+	/// whose deque runs dry steals from the back of the others, i.e. the continuations of tasks
+	/// that are still running long.
+	template< typename Task >
+	class TaskPool {
+
+	public:
+		/// Deals tasks round-robin to the deques of numThreads threads, chunk consecutive tasks at
+		/// a time, e.g. to keep neighbouring seeds on one thread.
+		TaskPool( size_t numThreads, std::vector< Task > tasks, size_t chunk = 1 ) :
+			m_queues( std::max< size_t >( numThreads, 1 ) ),
+			m_total( tasks.size() ),
+			m_pending( tasks.size() ),
+			m_finished( 0 )
+		{
+			for( size_t i=0; i<tasks.size(); i++ ) {
+				m_queues[ i / std::max< size_t >( chunk, 1 ) % m_queues.size() ].tasks.push_back( std::move( tasks[i] ) );
+			}
+		}
+
+		/// Next task of thread, its own or a stolen one. Waits while other threads still run
+		/// tasks that may be continued, and returns nothing once all tasks are finished or
+		/// abortFlag is set.
+		std::optional< Task > next( size_t thread, AbortFlag abortFlag = nullptr ) {
+			for( ;; ) {
+				if( abortFlag && *abortFlag ) return std::nullopt;
+				if( std::optional< Task > task = tryNext( thread ) ) return task;
+				if( m_pending.load() == 0 ) return std::nullopt;
+				std::this_thread::yield();
+			}
+		}
+
+		/// Like next(), but returns nothing right away if no task is queued, for a thread that
+		/// still holds unfinished tasks of its own and must not wait for them.
+		std::optional< Task > tryNext( size_t thread ) {
+			for( size_t i=0; i<m_queues.size(); i++ ) {
+				Queue& queue = m_queues[ ( thread + i ) % m_queues.size() ];
+				std::lock_guard< std::mutex > lock( queue.mutex );
+				if( queue.tasks.empty() ) continue;
+				if( i == 0 ) {
+					Task task( std::move( queue.tasks.front() ) );
+					queue.tasks.pop_front();
+					return task;
+				}
+				Task task( std::move( queue.tasks.back() ) );
+				queue.tasks.pop_back();
+				return task;
+			}
+			return std::nullopt;
+		}
+
+		/// Queues the continuation of a task that thread took with next().
+		void resume( size_t thread, Task task ) {
+			Queue& queue = m_queues[ thread % m_queues.size() ];
+			std::lock_guard< std::mutex > lock( queue.mutex );
+			queue.tasks.push_back( std::move( task ) );
+		}
+
+		/// Marks a task taken with next() as done.
+		void finish() {
+			m_finished++;
+			m_pending--;
+		}
+
+		size_t size() const {
+			return m_total;
+		}
+
+		size_t finished() const {
+			return m_finished.load();
+		}
+
+	private:
+		struct alignas( 64 ) Queue {
+			std::mutex mutex;
+			std::deque< Task > tasks;
+		};
+
+		std::vector< Queue > m_queues;
+		size_t m_total;
+		std::atomic< size_t > m_pending;
+		std::atomic< size_t > m_finished;
+	};
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "LRUCache.hpp"
+
+namespace fantom
+{
+
+	/// One file of an unsteady dataset.
+	struct TimeStep {
+		double time;
+		std::string path;
+	};
+
+	/// Lazily loaded sequence of time steps. A step is only loaded when it is requested and kept
+	/// in an LRU cache bounded by a memory budget. Requesting a step starts loading its successor
+	/// on a background thread, so that stepping forward through time doesn't wait for the disk.
+	template< typename T >
+	class TimeSeries {
+
+	public:
+		/// Loads a step and reports its size in bytes, returns nullptr and the reason in error on
+		/// failure.
+		using Loader = std::function< std::shared_ptr< const T >( const TimeStep& step, size_t& bytes, std::string& error ) >;
+
+		TimeSeries( std::vector< TimeStep > steps, Loader loader, size_t budget ) :
+			m_steps( std::move( steps ) ),
+			m_loader( std::move( loader ) ),
+			m_cache( budget )
+		{
+
+		}
+
+		~TimeSeries() {
+			// pending loads capture this
+			std::lock_guard< std::mutex > lock( m_mutex );
+			for( auto& pending : m_pending ) pending.second.wait();
+		}
+
+		TimeSeries( const TimeSeries& ) = delete;
+		TimeSeries& operator=( const TimeSeries& ) = delete;
+
+		const std::vector< TimeStep >& steps() const {
+			return m_steps;
+		}
+
+		size_t size() const {
+			return m_steps.size();
+		}
+
+		/// Index of the last step whose time is not after time, 0 if time lies before all steps.
+		size_t find( double time ) const {
+			size_t index = 0;
+			while( index + 1 < m_steps.size() && m_steps[index+1].time <= time ) index++;
+			return index;
+		}
+
+		/// Returns step index, loading it if necessary, and prefetches the next one.
+		std::shared_ptr< const T > get( size_t index, bool prefetchNext = true ) {
+			if( index >= m_steps.size() ) return nullptr;
+			std::shared_future< std::shared_ptr< const T > > future = request( index );
+			if( prefetchNext && index + 1 < m_steps.size() ) request( index + 1 );
+			return future.get();
+		}
+
+		/// Why the last load of step index failed, empty if it didn't.
+		std::string error( size_t index ) const {
+			std::lock_guard< std::mutex > lock( m_errorMutex );
+			auto found = m_errors.find( index );
+			return found == m_errors.end() ? std::string() : found->second;
+		}
+
+		/// Starts loading step index in the background unless it is cached or already loading.
+		void prefetch( size_t index ) {
+			if( index < m_steps.size() ) request( index );
+		}
+
+		void setBudget( size_t budget ) {
+			m_cache.setBudget( budget );
+		}
+
+		size_t memoryUsed() const {
+			return m_cache.used();
+		}
+
+	private:
+		std::vector< TimeStep > m_steps;
+		Loader m_loader;
+		LRUCache< size_t, T > m_cache;
+
+		std::mutex m_mutex;
+		std::map< size_t, std::shared_future< std::shared_ptr< const T > > > m_pending;
+		// separate from m_mutex, which the destructor holds while loads finish
+		mutable std::mutex m_errorMutex;
+		std::map< size_t, std::string > m_errors;
+
+		std::shared_future< std::shared_ptr< const T > > request( size_t index ) {
+			std::lock_guard< std::mutex > lock( m_mutex );
+
+			// forget finished loads, their results are in the cache by now
+			for( auto it = m_pending.begin(); it != m_pending.end(); ) {
+				if( it->second.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready ) it = m_pending.erase( it );
+				else ++it;
+			}
+
+			std::shared_ptr< const T > cached = m_cache.get( index );
+			if( cached ) {
+				std::promise< std::shared_ptr< const T > > ready;
+				ready.set_value( cached );
+				return ready.get_future().share();
+			}
+
+			auto pending = m_pending.find( index );
+			if( pending != m_pending.end() ) return pending->second;
+
+			std::shared_future< std::shared_ptr< const T > > future = std::async( std::launch::async, [this, index]() {
+				size_t bytes = 0;
+				std::string error;
+				std::shared_ptr< const T > value = m_loader( m_steps[index], bytes, error );
+				if( value ) m_cache.put( index, value, bytes );
+				std::lock_guard< std::mutex > lock( m_errorMutex );
+				if( value ) m_errors.erase( index );
+				else m_errors[index] = error;
+				return value;
+			} ).share();
+			m_pending[index] = future;
+			return future;
+		}
+	};
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "IntegrationCore.hpp"
+#include "IntegrationTasks.hpp"
+#include "LineArena.hpp"
+
+namespace fantom
+{
+
+	/// Position and time of a particle. Integrating it with the steppers of IntegrationCore in a
+	/// field whose time derivative is 1 integrates an unsteady field with the same methods.
+	template< typename V >
+	struct SpaceTime {
+		V x;
+		double t;
+	};
+
+	template< typename V >
+	inline SpaceTime< V > operator+( const SpaceTime< V >& a, const SpaceTime< V >& b ) {
+		return SpaceTime< V >{ a.x + b.x, a.t + b.t };
+	}
+
+	template< typename V >
+	inline SpaceTime< V > operator-( const SpaceTime< V >& a, const SpaceTime< V >& b ) {
+		return SpaceTime< V >{ a.x - b.x, a.t - b.t };
+	}
+
+	template< typename V >
+	inline SpaceTime< V > operator*( double s, const SpaceTime< V >& a ) {
+		return SpaceTime< V >{ s * a.x, s * a.t };
+	}
+
+	template< typename V >
+	inline double norm( const SpaceTime< V >& a ) {
+		const double n = norm( a.x );
+		return std::sqrt( n * n + a.t * a.t );
+	}
+
+	template< typename V >
+	inline SpaceTime< V > normalized( const SpaceTime< V >& a ) {
+		return ( 1.0 / norm( a ) ) * a;
+	}
+
+	namespace integration
+	{
+
+		/// Velocity of an unsteady field between two time steps, interpolated linearly in time
+		/// between the fields of both steps, with time advancing at rate 1. One instance per thread.
+		template< typename Field >
+		class TimeInterpolatedField {
+
+		public:
+			TimeInterpolatedField( Field first, Field second, double firstTime, double secondTime ) :
+				m_first( std::move( first ) ),
+				m_second( std::move( second ) ),
+				m_firstTime( firstTime ),
+				m_inverseDuration( 1.0 / ( secondTime - firstTime ) )
+			{
+
+			}
+
+			template< typename V >
+			bool operator()( const SpaceTime< V >& x, SpaceTime< V >& v ) {
+				V a, b;
+				if( !m_first( x.x, a ) || !m_second( x.x, b ) ) return false;
+				const double s = std::min( std::max( ( x.t - m_firstTime ) * m_inverseDuration, 0.0 ), 1.0 );
+				v.x = ( 1.0 - s ) * a + s * b;
+				v.t = 1.0;
+				return true;
+			}
+
+		private:
+			Field m_first;
+			Field m_second;
+			double m_firstTime;
+			double m_inverseDuration;
+		};
+
+		enum class ParticleLines {
+			Pathlines,		///< the path of a particle released at every seed at the start
+			Streaklines		///< the particles released at a seed over time, at the end
+		};
+
+		/// Outcome of advectParticles.
+		struct ParticleStats {
+			size_t particles = 0;	///< released particles
+			size_t steps = 0;
+			size_t windows = 0;		///< pairs of time steps integrated through
+			double time = 0.0;		///< time reached, the end unless particles ran out of data
+		};
+
+		/// Advects particles from seeds through an unsteady field given at ascending times, from
+		/// start to end. Only two time steps are needed at a time: setWindow( i ) makes steps i and
+		/// i+1 resident and returns false if it can't, and makeStepField( j ) then creates the field
+		/// of step i+j for one thread. The particles are advanced in parallel with copies of
+		/// makeStepper( h ), where every step of size h is at most stepSize and ends exactly at the
+		/// time steps and releases. A particle that leaves the domain stops there.
+		///
+		/// Pathlines are the paths of particles released at start, one line per seed starting at
+		/// it. Streaklines connect the particles released at a seed every releaseInterval, or at
+		/// every time step with releaseInterval 0, at the end time. They start at the seed and are
+		/// split where a particle was lost. The lines go into vertices, line i from offsets[i] to
+		/// offsets[i+1]. Particles stop early once abortFlag is set.
+		template< typename V, typename MakeStepper, typename SetWindow, typename MakeStepField >
+		inline ParticleStats advectParticles( ParticleLines lines, const std::vector< V >& seeds, const std::vector< double >& times, double start, double end,
+											  double stepSize, double releaseInterval, AbortFlag abortFlag, MakeStepper makeStepper,
+											  SetWindow setWindow, MakeStepField makeStepField, std::vector< V >& vertices, std::vector< size_t >& offsets ) {
+			struct Particle {
+				SpaceTime< V > x;
+				size_t seed;
+				bool alive;
+			};
+
+			ParticleStats stats;
+			stats.time = start;
+			vertices.clear();
+			offsets.assign( 1, 0 );
+			if( times.size() < 2 || !( start >= times.front() ) || !( start < times.back() ) || !( end > start ) || !( stepSize > 0.0 ) ) return stats;
+
+			const bool pathlines = lines == ParticleLines::Pathlines;
+			// particle r * seeds.size() + s is the r-th one released at seed s
+			std::vector< Particle > particles;
+			LineArena< V > paths( pathlines ? seeds.size() : 0 );
+			double lastRelease = -std::numeric_limits< double >::infinity();
+			auto release = [&]( double t ) {
+				for( size_t s=0; s<seeds.size(); s++ ) {
+					particles.push_back( Particle{ SpaceTime< V >{ seeds[s], t }, s, true } );
+					if( pathlines ) paths.push( s, seeds[s] );
+				}
+				stats.particles += seeds.size();
+				lastRelease = t;
+			};
+
+			// times closer than slack are the same, e.g. a release and the end of a window
+			const double slack = 1e-6 * stepSize;
+			size_t window = std::upper_bound( times.begin(), times.end(), start ) - times.begin() - 1;
+			double t = start;
+			double nextRelease = start;
+			size_t releases = 0;
+			std::vector< SpaceTime< V > > moving;
+			std::vector< size_t > movingIndex;
+			while( t < end && window + 1 < times.size() && !( abortFlag && *abortFlag ) ) {
+				if( !setWindow( window ) ) break;
+				stats.windows++;
+				const double windowEnd = std::min( times[window+1], end );
+
+				auto makeField = [&]() {
+					return TimeInterpolatedField< decltype( makeStepField( 0 ) ) >( makeStepField( 0 ), makeStepField( 1 ), times[window], times[window+1] );
+				};
+
+				while( t < windowEnd && !( abortFlag && *abortFlag ) ) {
+					// releases at the start, then at the interval or at every time step
+					if( pathlines ? particles.empty() : t >= nextRelease - slack ) {
+						release( t );
+						releases++;
+						nextRelease = releaseInterval > 0.0 ? start + releases * releaseInterval : windowEnd;
+					}
+					const double next = pathlines || nextRelease > windowEnd - slack ? windowEnd : nextRelease;
+
+					moving.clear();
+					movingIndex.clear();
+					for( size_t p=0; p<particles.size(); p++ ) {
+						if( !particles[p].alive ) continue;
+						moving.push_back( particles[p].x );
+						movingIndex.push_back( p );
+					}
+					const size_t numSteps = std::max< size_t >( size_t( std::ceil( ( next - t ) / stepSize - 1e-9 ) ), 1 );
+					const double h = ( next - t ) / numSteps;
+					auto makeSink = [&]( size_t line, const SpaceTime< V >& ) {
+						Particle* particle = &particles[ movingIndex[line] ];
+						return [&paths, particle, pathlines]( const SpaceTime< V >& x ) {
+							particle->x = x;
+							if( pathlines ) paths.push( particle->seed, x.x );
+						};
+					};
+					stats.steps += integrateLines( makeStepper( h ), false, moving, numSteps, abortFlag, makeField, makeSink, []( size_t, size_t ) {} );
+
+					// a particle that didn't reach next left the domain
+					for( size_t p : movingIndex ) {
+						if( particles[p].x.t < next - 0.5 * h ) particles[p].alive = false;
+					}
+					t = next;
+					stats.time = t;
+				}
+				if( t >= times[window+1] ) window++;
+			}
+
+			if( pathlines ) {
+				paths.merge( vertices, offsets );
+				return stats;
+			}
+			// the particles at the seeds themselves
+			if( !particles.empty() && lastRelease < t - slack ) release( t );
+
+			// newest particle first, so that every streakline starts at its seed, a single particle
+			// between lost ones makes no line
+			auto close = [&vertices, &offsets]() {
+				if( vertices.size() - offsets.back() == 1 ) vertices.pop_back();
+				if( vertices.size() > offsets.back() ) offsets.push_back( vertices.size() );
+			};
+			const size_t released = seeds.empty() ? 0 : particles.size() / seeds.size();
+			for( size_t s=0; s<seeds.size(); s++ ) {
+				for( size_t r=released; r-->0; ) {
+					const size_t p = r * seeds.size() + s;
+					if( particles[p].alive ) vertices.push_back( particles[p].x.x );
+					else close();
+				}
+				close();
+			}
+			return stats;
+		}
+	}
+}
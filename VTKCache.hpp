@@ -0,0 +1,260 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "MappedFile.hpp"
+#include "VTKReader.hpp"
+
+namespace fantom
+{
+
+	/// 64 bit hash of a memory range. The range is hashed in independent 1 MiB blocks in parallel
+	/// and the block hashes are combined in order, so the result doesn't depend on the thread count.
+	inline uint64_t hashBytes( const char* data, size_t size ) {
+		const uint64_t prime = 0x9E3779B97F4A7C15ull;
+		auto mix = []( uint64_t h ) {
+			h ^= h >> 33;
+			h *= 0xFF51AFD7ED558CCDull;
+			h ^= h >> 33;
+			h *= 0xC4CEB9FE1A85EC53ull;
+			return h ^ ( h >> 33 );
+		};
+
+		const size_t blockSize = 1 << 20;
+		size_t numBlocks = ( size + blockSize - 1 ) / blockSize;
+		std::vector< uint64_t > blockHashes( numBlocks );
+
+		#pragma omp parallel for schedule( static )
+		for( long long b=0; b<(long long)numBlocks; b++ ) {
+			const char* p = data + b * blockSize;
+			size_t n = std::min< size_t >( blockSize, size - b * blockSize );
+			uint64_t h = n * prime;
+			size_t i = 0;
+			for( ; i + 8 <= n; i += 8 ) {
+				uint64_t v;
+				std::memcpy( &v, p + i, 8 );
+				h = ( h ^ mix( v ) ) * prime;
+			}
+			uint64_t tail = 0;
+			std::memcpy( &tail, p + i, n - i );
+			blockHashes[b] = mix( h ^ mix( tail ) );
+		}
+
+		uint64_t h = size;
+		for( uint64_t blockHash : blockHashes ) {
+			h = mix( h ^ blockHash ) * prime;
+		}
+		return h;
+	}
+
+	/// Binary sidecar that stores a parsed VTK dataset next to its source file, so that loading
+	/// an unchanged file again only has to map the sidecar. A sidecar is valid as long as size and
+	/// modification time of the source match. Files that are replaced without a new modification
+	/// time, e.g. copied with their timestamps, are caught by also comparing the hash of the
+	/// content on request, which reads the source once but doesn't parse it.
+	class VtkCache {
+
+	public:
+		static std::string sidecarPath( const std::string& path ) {
+			return path + ".cache";
+		}
+
+		/// Fills data from the sidecar of path if it exists and is up to date, with verifyContent
+		/// also the hash of the source has to match. Only the rows of region are copied out of the
+		/// mapping.
+		static bool load( const std::string& path, VtkDataset& data, VtkRegion region = VtkRegion(), bool verifyContent = false ) {
+			SourceInfo source;
+			if( !stat( path, source ) ) return false;
+
+			MappedFile file( sidecarPath( path ) );
+			if( !file.isOpen() || file.size() < sizeof( Header ) ) return false;
+
+			Header header;
+			std::memcpy( &header, file.data(), sizeof( Header ) );
+			if( std::memcmp( header.magic, s_magic, sizeof( header.magic ) ) != 0 || header.version != s_version ) return false;
+			if( header.sourceSize != source.size || header.sourceMtime != source.mtime ) return false;
+			if( header.fileSize != file.size() ) return false;
+			if( verifyContent ) {
+				MappedFile sourceFile( path );
+				if( !sourceFile.isOpen() || hashBytes( sourceFile.data(), sourceFile.size() ) != header.contentHash ) return false;
+			}
+			size_t dims[3] = { header.dims[0], header.dims[1], header.dims[2] };
+			if( !region.fit( dims ) ) return false;
+
+			for( size_t d=0; d<3; d++ ) {
+				data.dims[d] = header.dims[d];
+				data.origin[d] = header.origin[d];
+				data.spacing[d] = header.spacing[d];
+			}
+			data.numPoints = header.numPoints;
+			data.layout = static_cast< VtkLayout >( header.layout );
+			data.contentHash = header.contentHash;
+
+			bool ok = copySection( file, header.points, data.points, region, dims, 3 );
+			for( size_t d=0; d<3; d++ ) ok = ok && copySection( file, header.coordinates[d], data.coordinates[d] );
+
+			// the array table follows the header
+			if( header.numArrays > ( file.size() - sizeof( Header ) ) / sizeof( ArrayEntry ) ) return false;
+			data.arrays.resize( header.numArrays );
+			for( size_t a=0; a<header.numArrays && ok; a++ ) {
+				ArrayEntry entry;
+				std::memcpy( &entry, file.data() + sizeof( Header ) + a * sizeof( ArrayEntry ), sizeof( ArrayEntry ) );
+				VtkArray& array = data.arrays[a];
+				array.name = std::string( entry.name, strnlen( entry.name, sizeof( entry.name ) ) );
+				array.numComponents = entry.numComponents;
+				ok = copySection( file, entry.values, array.values, region, dims, array.numComponents );
+			}
+			if( ok && !region.covers( dims ) ) cropLattice( data, region );
+			return ok;
+		}
+
+		/// Writes the sidecar for path. The source is hashed to fill data.contentHash, which
+		/// load() compares with verifyContent.
+		static bool store( const std::string& path, VtkDataset& data ) {
+			SourceInfo source;
+			if( !stat( path, source ) ) return false;
+			{
+				MappedFile file( path );
+				if( !file.isOpen() ) return false;
+				data.contentHash = hashBytes( file.data(), file.size() );
+			}
+
+			Header header;
+			std::memset( &header, 0, sizeof( Header ) );
+			std::memcpy( header.magic, s_magic, sizeof( header.magic ) );
+			header.version = s_version;
+			header.layout = static_cast< uint32_t >( data.layout );
+			header.sourceSize = source.size;
+			header.sourceMtime = source.mtime;
+			header.contentHash = data.contentHash;
+			for( size_t d=0; d<3; d++ ) {
+				header.dims[d] = data.dims[d];
+				header.origin[d] = data.origin[d];
+				header.spacing[d] = data.spacing[d];
+			}
+			header.numPoints = data.numPoints;
+			header.numArrays = data.arrays.size();
+
+			std::vector< ArrayEntry > entries( data.arrays.size() );
+			std::memset( entries.data(), 0, entries.size() * sizeof( ArrayEntry ) );
+			uint64_t offset = align( sizeof( Header ) + entries.size() * sizeof( ArrayEntry ) );
+			header.points = placeSection( offset, data.points );
+			for( size_t d=0; d<3; d++ ) header.coordinates[d] = placeSection( offset, data.coordinates[d] );
+			uint64_t end = header.coordinates[2].offset + data.coordinates[2].size() * sizeof( float );
+			for( size_t a=0; a<entries.size(); a++ ) {
+				std::strncpy( entries[a].name, data.arrays[a].name.c_str(), sizeof( entries[a].name ) - 1 );
+				entries[a].numComponents = data.arrays[a].numComponents;
+				entries[a].values = placeSection( offset, data.arrays[a].values );
+				end = entries[a].values.offset + data.arrays[a].values.size() * sizeof( float );
+			}
+			header.fileSize = end;
+
+			// write to a temporary file first so that readers never see a partial sidecar
+			std::string target = sidecarPath( path );
+			std::string temp = target + ".tmp";
+			std::FILE* out = std::fopen( temp.c_str(), "wb" );
+			if( !out ) return false;
+			bool ok = std::fwrite( &header, sizeof( Header ), 1, out ) == 1;
+			ok = ok && ( entries.empty() || std::fwrite( entries.data(), sizeof( ArrayEntry ), entries.size(), out ) == entries.size() );
+			ok = ok && writeSection( out, header.points, data.points );
+			for( size_t d=0; d<3; d++ ) ok = ok && writeSection( out, header.coordinates[d], data.coordinates[d] );
+			for( size_t a=0; a<entries.size(); a++ ) ok = ok && writeSection( out, entries[a].values, data.arrays[a].values );
+			ok = std::fclose( out ) == 0 && ok;
+			if( !ok || std::rename( temp.c_str(), target.c_str() ) != 0 ) {
+				std::remove( temp.c_str() );
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		static constexpr const char* s_magic = "LAOVTKC\0";
+		static const uint32_t s_version = 2;
+
+		struct Section {
+			uint64_t offset;
+			uint64_t count;
+		};
+
+		struct Header {
+			char magic[8];
+			uint32_t version;
+			uint32_t layout;
+			uint64_t fileSize;
+			uint64_t sourceSize;
+			int64_t sourceMtime;
+			uint64_t contentHash;
+			uint64_t dims[3];
+			uint64_t numPoints;
+			double origin[3];
+			double spacing[3];
+			uint64_t numArrays;
+			Section points;
+			Section coordinates[3];
+		};
+
+		struct ArrayEntry {
+			char name[256];
+			uint64_t numComponents;
+			Section values;
+		};
+
+		struct SourceInfo {
+			uint64_t size;
+			int64_t mtime;
+		};
+
+		static bool stat( const std::string& path, SourceInfo& info ) {
+			struct stat st;
+			if( ::stat( path.c_str(), &st ) != 0 ) return false;
+			info.size = st.st_size;
+			info.mtime = int64_t( st.st_mtim.tv_sec ) * 1000000000 + st.st_mtim.tv_nsec;
+			return true;
+		}
+
+		// sections start on cache line boundaries
+		static uint64_t align( uint64_t offset ) {
+			return ( offset + 63 ) & ~uint64_t( 63 );
+		}
+
+		static Section placeSection( uint64_t& offset, const std::vector< float >& values ) {
+			Section section = { offset, values.size() };
+			offset = align( offset + values.size() * sizeof( float ) );
+			return section;
+		}
+
+		static bool writeSection( std::FILE* out, const Section& section, const std::vector< float >& values ) {
+			static const char zeros[64] = {};
+			long pos = std::ftell( out );
+			if( pos < 0 || uint64_t( pos ) > section.offset ) return false;
+			if( std::fwrite( zeros, 1, section.offset - pos, out ) != section.offset - pos ) return false;
+			return values.empty() || std::fwrite( values.data(), sizeof( float ), values.size(), out ) == values.size();
+		}
+
+		static bool copySection( const MappedFile& file, const Section& section, std::vector< float >& values ) {
+			if( section.offset > file.size() || section.count > ( file.size() - section.offset ) / sizeof( float ) ) return false;
+			values.resize( section.count );
+			if( section.count ) std::memcpy( values.data(), file.data() + section.offset, section.count * sizeof( float ) );
+			return true;
+		}
+
+		// Copies the points of region from a section holding components values per grid point.
+		static bool copySection( const MappedFile& file, const Section& section, std::vector< float >& values, const VtkRegion& region, const size_t dims[3], size_t components ) {
+			if( region.covers( dims ) || section.count == 0 ) return copySection( file, section, values );
+			if( section.offset > file.size() || section.count != dims[0] * dims[1] * dims[2] * components ) return false;
+			if( section.count > ( file.size() - section.offset ) / sizeof( float ) ) return false;
+			values.resize( region.numPoints() * components );
+			const char* src = file.data() + section.offset;
+			gatherRegion( region, dims, components, values.data(), [src]( size_t first, size_t count, float* out ) {
+				std::memcpy( out, src + first * sizeof( float ), count * sizeof( float ) );
+			} );
+			return true;
+		}
+	};
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fantom/algorithm.hpp>
+#include <fantom/fields.hpp>
+
+#include "VTKFile.hpp"
+#include "VTKReader.hpp"
+
+namespace fantom
+{
+
+	/// Builds the fantom grid matching the layout of data. Explicit point coordinates are
+	/// released as soon as they are converted to keep peak memory low. With Precision::FLOAT32
+	/// coordinates are stored in single precision, which is all that VTK files usually hold.
+	/// DomainFactory only takes double points, so curvilinear grids still pass through a double
+	/// copy while they are built: FLOAT32 halves what stays resident, not the peak of loading.
+	inline std::shared_ptr< const Grid< 3 > > makeVtkGrid( VtkDataset& data, Precision precision = Precision::FLOAT64 ) {
+		size_t extend[] = { data.dims[0], data.dims[1], data.dims[2] };
+		std::shared_ptr< const DiscreteDomain< 3 > > domain;
+		if( data.layout == VtkLayout::Uniform ) {
+			domain = DomainFactory::makeDomainUniform( extend, data.origin, data.spacing, precision );
+		} else if( data.layout == VtkLayout::Rectilinear ) {
+			std::vector< double > coordinates[3];
+			for( size_t d=0; d<3; d++ ) {
+				coordinates[d].assign( data.coordinates[d].begin(), data.coordinates[d].end() );
+			}
+			domain = DomainFactory::makeDomainRectilinear( coordinates, precision );
+		} else {
+			std::vector< Tensor< double, 3 > > gridPoints( data.numPoints );
+			for( size_t i=0; i<data.numPoints; i++ ) {
+				gridPoints[i] = Tensor< double, 3 >( data.points[3*i], data.points[3*i+1], data.points[3*i+2] );
+			}
+			std::vector< float >().swap( data.points );
+			domain = DomainFactory::makeDomainCurvilinear( extend, gridPoints, precision );
+		}
+		return DomainFactory::makeGridStructured( *domain );
+	}
+
+	/// Builds a vector or scalar field on grid from the values of array and releases them.
+	/// precision selects how the field stores its values; interpolation always returns doubles.
+	/// The values pass through double tensors for DomainFactory either way, so the peak while
+	/// building is that of a double field plus the stored one. Returns nullptr for other
+	/// component counts.
+	inline std::shared_ptr< const TensorFieldBase > makeVtkField( const Grid< 3 >& grid, VtkArray& array, Precision precision = Precision::FLOAT64 ) {
+		const size_t numPoints = array.values.size() / std::max< size_t >( array.numComponents, 1 );
+		std::shared_ptr< const TensorFieldBase > tensorField;
+		if( array.numComponents == 3 ) {
+			std::vector< Tensor< double, 3 > > vectors( numPoints );
+			for( size_t i=0; i<numPoints; i++ ) {
+				vectors[i] = Tensor< double, 3 >( array.values[3*i], array.values[3*i+1], array.values[3*i+2] );
+			}
+			std::vector< float >().swap( array.values );
+			tensorField = DomainFactory::makeTensorField( grid, vectors, precision );
+		} else if( array.numComponents == 1 ) {
+			std::vector< Tensor< double, 1 > > scalars( numPoints );
+			for( size_t i=0; i<numPoints; i++ ) {
+				scalars[i] = Tensor< double, 1 >( array.values[i] );
+			}
+			std::vector< float >().swap( array.values );
+			tensorField = DomainFactory::makeTensorField( grid, scalars, precision );
+		}
+		return tensorField;
+	}
+
+	/// Builds one field per array of data, all sharing grid. Entries for arrays with unsupported
+	/// component counts are nullptr.
+	inline std::vector< std::shared_ptr< const TensorFieldBase > > makeVtkFields( const Grid< 3 >& grid, VtkDataset& data, Precision precision = Precision::FLOAT64 ) {
+		std::vector< std::shared_ptr< const TensorFieldBase > > fields;
+		for( VtkArray& array : data.arrays ) fields.push_back( makeVtkField( grid, array, precision ) );
+		return fields;
+	}
+
+	/// Adds the options of a VtkRegion the way all VTK loaders offer them, first and last point
+	/// and a stride per axis, through add( name, description, value ) for int options.
+	template< typename Add >
+	inline void addVtkRegionOptions( Add add ) {
+		const std::string axes[] = { "i", "j", "k" };
+		for( size_t d=0; d<3; d++ ) {
+			add( "First " + axes[d], "First point index along " + axes[d] + " to load", 0 );
+			add( "Last " + axes[d], "Last point index along " + axes[d] + " to load, -1 for the end of the grid", -1 );
+			add( "Stride " + axes[d], "Load every n-th point along " + axes[d], 1 );
+		}
+	}
+
+	/// The region selected by the options of addVtkRegionOptions.
+	inline VtkRegion vtkRegion( const Algorithm::Options& options ) {
+		VtkRegion region;
+		const std::string axes[] = { "i", "j", "k" };
+		for( size_t d=0; d<3; d++ ) {
+			int last = options.get< int >( "Last " + axes[d] );
+			region.begin[d] = std::max( options.get< int >( "First " + axes[d] ), 0 );
+			region.end[d] = last < 0 ? SIZE_MAX : size_t( last );
+			region.stride[d] = std::max( options.get< int >( "Stride " + axes[d] ), 1 );
+		}
+		return region;
+	}
+
+	/// Number of field outputs of the VTK loaders.
+	const size_t vtkFieldOutputs = 8;
+
+	/// Output name of the field built from array index. The first one keeps the name
+	/// "tensor field" so that existing networks stay connected.
+	inline std::string vtkFieldOutputName( size_t index ) {
+		return index == 0 ? "tensor field" : "tensor field " + std::to_string( index + 1 );
+	}
+
+	/// Grid and fields of one file, e.g. one step of a time series.
+	struct VtkFieldData {
+		std::shared_ptr< const Grid< 3 > > grid;
+		std::vector< std::shared_ptr< const TensorFieldBase > > fields;
+		std::vector< std::string > names;
+	};
+
+	/// Builds the grid of data and one field per array on it, releasing the values of data.
+	inline std::shared_ptr< const VtkFieldData > makeVtkFieldData( VtkDataset& data, Precision precision = Precision::FLOAT64 ) {
+		std::shared_ptr< VtkFieldData > result = std::make_shared< VtkFieldData >();
+		for( const VtkArray& array : data.arrays ) result->names.push_back( array.name );
+		result->grid = makeVtkGrid( data, precision );
+		result->fields = makeVtkFields( *result->grid, data, precision );
+		return result;
+	}
+
+	/// Exposes the fields of data the way all VTK loaders do: the first vtkFieldOutputs fields
+	/// go to output( vtkFieldOutputName( a ), field ), and log( message ) tells which array went
+	/// where and which were skipped.
+	template< typename Output, typename Log >
+	inline void exposeVtkFields( const VtkFieldData& data, Output output, Log log ) {
+		for( size_t a=0; a<data.fields.size(); a++ ) {
+			const std::string& name = data.names[a];
+			if( !data.fields[a] ) {
+				log( "Unsupported number of components in " + name );
+			} else if( a >= vtkFieldOutputs ) {
+				log( "Skipped " + name + ", only " + std::to_string( vtkFieldOutputs ) + " arrays are exposed" );
+			} else {
+				log( vtkFieldOutputName( a ) + ": " + name );
+				output( vtkFieldOutputName( a ), data.fields[a] );
+			}
+		}
+	}
+
+	/// Reads any supported VTK file with readVtkFile and builds its grid and fields. bytes
+	/// receives an estimate of the memory held by the result.
+	inline std::shared_ptr< const VtkFieldData > loadVtkFieldData( const std::string& path, bool detectRegular, Precision precision, const VtkReadOptions& read, size_t& bytes, std::string& error ) {
+		VtkDataset data;
+		if( !readVtkFile( path, data, error, read ) ) return nullptr;
+		if( detectRegular ) detectRegularLayout( data );
+
+		const size_t valueSize = precision == Precision::FLOAT32 ? sizeof( float ) : sizeof( double );
+		bytes = 0;
+		for( const VtkArray& array : data.arrays ) bytes += array.values.size() * valueSize;
+		if( data.layout == VtkLayout::Curvilinear ) bytes += data.numPoints * 3 * valueSize;
+		if( data.layout == VtkLayout::Rectilinear ) bytes += ( data.dims[0] + data.dims[1] + data.dims[2] ) * valueSize;
+
+		std::shared_ptr< const VtkFieldData > result = makeVtkFieldData( data, precision );
+		if( result->fields.empty() || !result->fields[0] ) {
+			error = "Unsupported number of components";
+			return nullptr;
+		}
+		return result;
+	}
+}
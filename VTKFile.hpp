@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fnmatch.h>
+
+#include "TimeSeries.hpp"
+#include "VTKCache.hpp"
+#include "VTKReader.hpp"
+#include "VTKXMLReader.hpp"
+
+namespace fantom
+{
+
+	/// How readVtkFile reads a file.
+	struct VtkReadOptions {
+		bool useCache = false;		///< go through the binary sidecar of legacy files, which writes next to the file
+		bool verifyCache = false;	///< also compare the content hash of the sidecar, see VtkCache::load
+		int numThreads = 0;			///< threads for parsing ASCII legacy files, 0 uses all cores
+		VtkRegion region;			///< points to read, the whole grid by default
+	};
+
+	/// Reads a legacy (.vtk) or XML (.vti, .vtr, .vts) file, chosen by its extension, restricted
+	/// to options.region. Legacy files only read the rows of the region; XML files are read
+	/// completely and cropped afterwards, since their arrays may be compressed. A sidecar is
+	/// only written when the whole grid was read.
+	inline bool readVtkFile( const std::string& path, VtkDataset& data, std::string& error, const VtkReadOptions& options = VtkReadOptions() ) {
+		std::string extension = std::filesystem::path( path ).extension().string();
+		if( extension == ".vti" || extension == ".vtr" || extension == ".vts" ) {
+			VtkXmlReader reader;
+			if( !reader.read( path, data ) ) {
+				error = reader.error();
+				return false;
+			}
+			if( !cropDataset( data, options.region ) ) {
+				error = "Region lies outside the grid";
+				return false;
+			}
+			return true;
+		}
+
+		if( options.useCache && VtkCache::load( path, data, options.region, options.verifyCache ) ) return true;
+		VtkLegacyReader reader;
+		reader.setNumThreads( options.numThreads );
+		reader.setRegion( options.region );
+		if( !reader.read( path, data ) ) {
+			error = reader.error();
+			return false;
+		}
+		if( options.useCache && options.region.whole() ) VtkCache::store( path, data );
+		return true;
+	}
+
+	namespace detail
+	{
+		// Orders file names with embedded numbers naturally, so that run_10 follows run_9.
+		inline bool naturalLess( const std::string& a, const std::string& b ) {
+			size_t i = 0, j = 0;
+			while( i < a.size() && j < b.size() ) {
+				if( std::isdigit( a[i] ) && std::isdigit( b[j] ) ) {
+					size_t ei = i, ej = j;
+					while( ei < a.size() && std::isdigit( a[ei] ) ) ei++;
+					while( ej < b.size() && std::isdigit( b[ej] ) ) ej++;
+					std::string na = a.substr( i, ei - i ), nb = b.substr( j, ej - j );
+					na.erase( 0, std::min( na.find_first_not_of( '0' ), na.size() ) );
+					nb.erase( 0, std::min( nb.find_first_not_of( '0' ), nb.size() ) );
+					if( na.size() != nb.size() ) return na.size() < nb.size();
+					if( na != nb ) return na < nb;
+					i = ei;
+					j = ej;
+				} else {
+					if( a[i] != b[j] ) return a[i] < b[j];
+					i++;
+					j++;
+				}
+			}
+			return a.size() - i < b.size() - j;
+		}
+
+		// Value of the last number in a file name, or -1.
+		inline double lastNumber( const std::string& name ) {
+			size_t end = name.find_last_of( "0123456789" );
+			if( end == std::string::npos ) return -1.0;
+			size_t begin = end;
+			while( begin > 0 && std::isdigit( name[begin-1] ) ) begin--;
+			return std::stod( name.substr( begin, end - begin + 1 ) );
+		}
+	}
+
+	/// Lists the time steps of an unsteady dataset without reading them. pattern is either a
+	/// ParaView .pvd collection or a path whose file name contains * or ? wildcards, e.g.
+	/// /data/run_*.vtk. Matches are ordered naturally and their time is the last number in the
+	/// file name, or the position in the sequence if a name contains no number.
+	inline bool indexVtkSeries( const std::string& pattern, std::vector< TimeStep >& steps, std::string& error ) {
+		namespace fs = std::filesystem;
+		steps.clear();
+		fs::path patternPath( pattern );
+		fs::path directory = patternPath.has_parent_path() ? patternPath.parent_path() : fs::path( "." );
+
+		if( patternPath.extension() == ".pvd" ) {
+			std::ifstream file( pattern );
+			if( !file ) {
+				error = "Cannot open " + pattern;
+				return false;
+			}
+			std::stringstream buffer;
+			buffer << file.rdbuf();
+			std::string xml = buffer.str();
+
+			std::string_view tag;
+			for( size_t pos = findXmlTag( xml, "DataSet", 0, tag ); pos; pos = findXmlTag( xml, "DataSet", pos, tag ) ) {
+				TimeStep step;
+				if( !parseNumberList( xmlAttribute( tag, "timestep" ), &step.time, 1 ) ) step.time = steps.size();
+				fs::path path( std::string( xmlAttribute( tag, "file" ) ) );
+				step.path = ( path.is_absolute() ? path : directory / path ).string();
+				steps.push_back( step );
+			}
+			std::stable_sort( steps.begin(), steps.end(), []( const TimeStep& a, const TimeStep& b ) { return a.time < b.time; } );
+		} else {
+			std::string filePattern = patternPath.filename().string();
+			std::vector< std::string > names;
+			std::error_code ec;
+			for( const fs::directory_entry& entry : fs::directory_iterator( directory, ec ) ) {
+				std::string name = entry.path().filename().string();
+				if( entry.is_regular_file() && fnmatch( filePattern.c_str(), name.c_str(), 0 ) == 0 ) names.push_back( name );
+			}
+			if( ec ) {
+				error = "Cannot list " + directory.string();
+				return false;
+			}
+			std::sort( names.begin(), names.end(), detail::naturalLess );
+
+			bool numbered = std::all_of( names.begin(), names.end(), []( const std::string& name ) { return detail::lastNumber( name ) >= 0.0; } );
+			for( size_t i=0; i<names.size(); i++ ) {
+				steps.push_back( TimeStep{ numbered ? detail::lastNumber( names[i] ) : double( i ), ( directory / names[i] ).string() } );
+			}
+		}
+
+		if( steps.empty() ) {
+			error = "No files match " + pattern;
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,725 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "ByteSwap.hpp"
+#include "MappedFile.hpp"
+
+namespace fantom
+{
+
+	/// How the point positions of a structured grid are described.
+	enum class VtkLayout {
+		Curvilinear,	///< explicit coordinates for every point
+		Rectilinear,	///< one coordinate array per axis
+		Uniform			///< origin and spacing
+	};
+
+	/// One POINT_DATA array.
+	struct VtkArray {
+		std::string name;
+
+		/// numComponents values per point.
+		std::vector< float > values;
+		size_t numComponents = 0;
+	};
+
+	/// Contents of a legacy VTK structured grid file.
+	struct VtkDataset {
+		size_t dims[3] = { 0, 0, 0 };
+		size_t numPoints = 0;
+
+		VtkLayout layout = VtkLayout::Curvilinear;
+
+		/// Point coordinates, x y z interleaved. Only set for curvilinear grids.
+		std::vector< float > points;
+
+		/// Axis coordinates of rectilinear grids.
+		std::vector< float > coordinates[3];
+
+		/// Lattice of uniform grids.
+		double origin[3] = { 0.0, 0.0, 0.0 };
+		double spacing[3] = { 1.0, 1.0, 1.0 };
+
+		/// All POINT_DATA arrays in file order.
+		std::vector< VtkArray > arrays;
+
+		/// Hash of the source file, 0 if unknown.
+		uint64_t contentHash = 0;
+	};
+
+	/// Index sub-box [begin, end] (inclusive) with a stride per axis, selecting which points of a
+	/// structured grid are loaded. The default selects the whole grid.
+	struct VtkRegion {
+		size_t begin[3] = { 0, 0, 0 };
+		size_t end[3] = { SIZE_MAX, SIZE_MAX, SIZE_MAX };
+		size_t stride[3] = { 1, 1, 1 };
+
+		/// Clamps the region to a grid of dims points. Returns false if no point is selected.
+		bool fit( const size_t dims[3] ) {
+			for( size_t d=0; d<3; d++ ) {
+				if( dims[d] == 0 || begin[d] >= dims[d] || begin[d] > end[d] ) return false;
+				end[d] = std::min( end[d], dims[d] - 1 );
+				stride[d] = std::max< size_t >( stride[d], 1 );
+				end[d] -= ( end[d] - begin[d] ) % stride[d];
+			}
+			return true;
+		}
+
+		/// Number of selected points along axis d, only valid after fit().
+		size_t count( size_t d ) const {
+			return ( end[d] - begin[d] ) / stride[d] + 1;
+		}
+
+		size_t numPoints() const {
+			return count( 0 ) * count( 1 ) * count( 2 );
+		}
+
+		/// True if nothing was restricted, i.e. every grid is loaded completely.
+		bool whole() const {
+			const size_t unbounded[3] = { SIZE_MAX, SIZE_MAX, SIZE_MAX };
+			return covers( unbounded );
+		}
+
+		bool operator==( const VtkRegion& other ) const {
+			for( size_t d=0; d<3; d++ ) {
+				if( begin[d] != other.begin[d] || end[d] != other.end[d] || stride[d] != other.stride[d] ) return false;
+			}
+			return true;
+		}
+
+		bool operator!=( const VtkRegion& other ) const {
+			return !( *this == other );
+		}
+
+		bool covers( const size_t dims[3] ) const {
+			for( size_t d=0; d<3; d++ ) {
+				if( begin[d] != 0 || stride[d] != 1 || end[d] < dims[d] - 1 ) return false;
+			}
+			return true;
+		}
+	};
+
+	/// Collects the points of a fitted region from a lattice of dims points with components
+	/// values each. load( first, count, out ) has to copy count consecutive values starting at
+	/// value index first of the full lattice, so only the selected rows are ever touched.
+	template< typename Load >
+	inline void gatherRegion( const VtkRegion& region, const size_t dims[3], size_t components, float* out, Load load ) {
+		const size_t nx = region.count( 0 ), ny = region.count( 1 ), nz = region.count( 2 );
+		#pragma omp parallel for schedule( static )
+		for( long long row=0; row<(long long)( ny * nz ); row++ ) {
+			size_t j = region.begin[1] + ( row % ny ) * region.stride[1];
+			size_t k = region.begin[2] + ( row / ny ) * region.stride[2];
+			size_t first = ( k * dims[1] + j ) * dims[0] + region.begin[0];
+			float* target = out + row * nx * components;
+			if( region.stride[0] == 1 ) {
+				load( first * components, nx * components, target );
+			} else {
+				for( size_t i=0; i<nx; i++ ) {
+					load( ( first + i * region.stride[0] ) * components, components, target + i * components );
+				}
+			}
+		}
+	}
+
+	/// Restricts the lattice description of data, which still has the full dims, to a fitted
+	/// region: dims and numPoints, rectilinear coordinates, or origin and spacing.
+	inline void cropLattice( VtkDataset& data, const VtkRegion& region ) {
+		for( size_t d=0; d<3; d++ ) {
+			if( data.layout == VtkLayout::Rectilinear && !data.coordinates[d].empty() ) {
+				std::vector< float > axis( region.count( d ) );
+				for( size_t i=0; i<axis.size(); i++ ) axis[i] = data.coordinates[d][ region.begin[d] + i * region.stride[d] ];
+				data.coordinates[d].swap( axis );
+			}
+			data.origin[d] += region.begin[d] * data.spacing[d];
+			data.spacing[d] *= region.stride[d];
+			data.dims[d] = region.count( d );
+		}
+		data.numPoints = region.numPoints();
+	}
+
+	/// Crops a completely loaded dataset to region. Returns false if the region is empty.
+	inline bool cropDataset( VtkDataset& data, VtkRegion region ) {
+		if( !region.fit( data.dims ) ) return false;
+		if( region.covers( data.dims ) ) return true;
+
+		auto crop = [&]( std::vector< float >& values, size_t components ) {
+			if( values.empty() ) return;
+			std::vector< float > cropped( region.numPoints() * components );
+			const float* src = values.data();
+			gatherRegion( region, data.dims, components, cropped.data(), [src]( size_t first, size_t count, float* out ) {
+				std::memcpy( out, src + first, count * sizeof( float ) );
+			} );
+			values.swap( cropped );
+		};
+		crop( data.points, 3 );
+		for( VtkArray& array : data.arrays ) crop( array.values, array.numComponents );
+		cropLattice( data, region );
+		return true;
+	}
+
+	/// Parses a number token without allocating. A leading '+' is accepted because
+	/// std::from_chars rejects it but some VTK writers emit it.
+	template< typename T >
+	inline bool parseNumber( std::string_view token, T& value ) {
+		const char* first = token.data();
+		const char* last = token.data() + token.size();
+		if( first != last && *first == '+' ) first++;
+		std::from_chars_result res = std::from_chars( first, last, value );
+		return res.ec == std::errc() && res.ptr == last;
+	}
+
+	/// Splits a file into whitespace separated tokens while reading it once in fixed-size chunks.
+	/// Only one chunk (plus a partial token carried over from the previous one) is held in memory.
+	/// Alternatively tokenizes a memory range, e.g. a mapped file, in place.
+	class VtkTokenizer {
+
+	public:
+		VtkTokenizer( const std::string& path, size_t chunkSize = 4 << 20 ) :
+			m_file( std::fopen( path.c_str(), "rb" ) ),
+			m_buffer( chunkSize ),
+			m_cur( m_buffer.data() ),
+			m_end( m_buffer.data() )
+		{
+
+		}
+
+		VtkTokenizer( const char* begin, const char* end ) :
+			m_file( nullptr ),
+			m_cur( begin ),
+			m_end( end )
+		{
+
+		}
+
+		~VtkTokenizer() {
+			if( m_file ) std::fclose( m_file );
+		}
+
+		VtkTokenizer( const VtkTokenizer& ) = delete;
+		VtkTokenizer& operator=( const VtkTokenizer& ) = delete;
+
+		bool isOpen() const {
+			return m_file != nullptr || m_cur != m_end;
+		}
+
+		/// Current read position. Only meaningful for memory ranges.
+		const char* position() const {
+			return m_cur;
+		}
+
+		const char* end() const {
+			return m_end;
+		}
+
+		void seek( const char* pos ) {
+			m_cur = pos;
+		}
+
+		/// Returns the next token. The view stays valid until the next call.
+		bool next( std::string_view& token ) {
+			// skip whitespace
+			for( ;; ) {
+				while( m_cur != m_end && isSpace( *m_cur ) ) m_cur++;
+				if( m_cur != m_end ) break;
+				if( !refill( m_end ) ) return false;
+			}
+
+			const char* start = m_cur;
+			for( ;; ) {
+				while( m_cur != m_end && !isSpace( *m_cur ) ) m_cur++;
+				if( m_cur != m_end ) break;
+
+				// token continues in the next chunk
+				if( !m_file ) break;
+				size_t offset = m_cur - start;
+				bool more = refill( start );
+				start = m_buffer.data();
+				m_cur = start + offset;
+				if( !more ) break;
+			}
+
+			token = std::string_view( start, m_cur - start );
+			return true;
+		}
+
+		/// Reads the rest of the current line, e.g. the free-form title of a VTK file.
+		bool readLine( std::string& line ) {
+			line.clear();
+			for( ;; ) {
+				const char* eol = static_cast< const char* >( std::memchr( m_cur, '\n', m_end - m_cur ) );
+				if( eol ) {
+					line.append( m_cur, eol );
+					m_cur = eol + 1;
+					if( !line.empty() && line.back() == '\r' ) line.pop_back();
+					return true;
+				}
+				line.append( m_cur, m_end );
+				m_cur = m_end;
+				if( !refill( m_end ) ) return !line.empty();
+			}
+		}
+
+		/// Parses count numbers straight into out.
+		template< typename T >
+		bool parse( T* out, size_t count ) {
+			std::string_view token;
+			for( size_t i=0; i<count; i++ ) {
+				if( !next( token ) || !parseNumber( token, out[i] ) ) return false;
+			}
+			return true;
+		}
+
+	private:
+		std::FILE* m_file;
+		std::vector< char > m_buffer;
+		const char* m_cur;
+		const char* m_end;
+
+		static bool isSpace( char c ) {
+			return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+		}
+
+		// Moves [keep, m_end) to the front of the buffer and fills the rest from the file.
+		bool refill( const char* keep ) {
+			if( !m_file ) return false;
+
+			size_t kept = m_end - keep;
+			if( kept == m_buffer.size() ) {
+				// a single token larger than the chunk
+				size_t keepOffset = keep - m_buffer.data();
+				m_buffer.resize( m_buffer.size() * 2 );
+				keep = m_buffer.data() + keepOffset;
+			}
+			std::memmove( m_buffer.data(), keep, kept );
+
+			size_t read = std::fread( m_buffer.data() + kept, 1, m_buffer.size() - kept, m_file );
+			m_cur = m_buffer.data() + kept;
+			m_end = m_cur + read;
+			return read > 0;
+		}
+	};
+
+	/// Parses count whitespace separated numbers from the text in [begin, end) into out using
+	/// numThreads threads. The text is cut into byte ranges aligned to whitespace, tokens are
+	/// counted per range in parallel, a prefix sum gives every range its offset in out, and then
+	/// all ranges are parsed in parallel. Counting stops at the first keyword, so end may lie far
+	/// behind the section. The result is identical to a serial parse. On success stop points
+	/// behind the last parsed token.
+	inline bool parseNumbersParallel( const char* begin, const char* end, float* out, size_t count, int numThreads, const char*& stop ) {
+		auto isSpace = []( char c ) {
+			return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+		};
+		auto isKeyword = [&]( const char* token, const char* tokenEnd ) {
+			// section keywords start with a letter, but so do nan and inf
+			float value;
+			return ( ( *token >= 'A' && *token <= 'Z' ) || ( *token >= 'a' && *token <= 'z' ) ) &&
+				!parseNumber( std::string_view( token, tokenEnd - token ), value );
+		};
+
+		// Counting everything up to the end of the file would also count the following sections,
+		// so first try a window that fits typical number lengths and widen it if it was too short.
+		const char* fileEnd = end;
+		if( size_t( end - begin ) > 32 * count + 4096 ) {
+			end = begin + 32 * count + 4096;
+			while( end != fileEnd && !isSpace( *end ) ) end++;
+		}
+
+		// chunk boundaries, moved forward onto whitespace so that no token is split
+		size_t numChunks = std::max( 1, numThreads ) * 8;
+		size_t chunkSize = std::max< size_t >( ( end - begin ) / numChunks + 1, 1 << 16 );
+		std::vector< const char* > bounds( 1, begin );
+		while( bounds.back() != end ) {
+			const char* b = bounds.back() + std::min< size_t >( chunkSize, end - bounds.back() );
+			while( b != end && !isSpace( *b ) ) b++;
+			bounds.push_back( b );
+		}
+		numChunks = bounds.size() - 1;
+
+		// pass 1: count tokens per chunk, remember where a chunk runs into the next keyword
+		std::vector< size_t > counts( numChunks + 1, 0 );
+		std::vector< const char* > keywords( numChunks, nullptr );
+		#pragma omp parallel for schedule( dynamic ) num_threads( numThreads )
+		for( int c=0; c<(int)numChunks; c++ ) {
+			const char* p = bounds[c];
+			const char* e = bounds[c+1];
+			size_t n = 0;
+			while( p != e ) {
+				while( p != e && isSpace( *p ) ) p++;
+				if( p == e ) break;
+				const char* token = p;
+				while( p != e && !isSpace( *p ) ) p++;
+				if( !( ( *token >= '0' && *token <= '9' ) || *token == '-' || *token == '.' || *token == '+' ) && isKeyword( token, p ) ) {
+					keywords[c] = token;
+					break;
+				}
+				n++;
+			}
+			counts[c] = n;
+		}
+
+		// exclusive prefix sum up to the chunk that contains the keyword
+		size_t used = 0;
+		size_t total = 0;
+		while( used < numChunks ) {
+			size_t n = counts[used];
+			counts[used] = total;
+			total += n;
+			if( keywords[used++] ) break;
+		}
+		counts[used] = total;
+		if( total < count ) {
+			bool truncated = end != fileEnd && !keywords[used-1];
+			return truncated && parseNumbersParallel( begin, fileEnd, out, count, numThreads, stop );
+		}
+
+		// pass 2: parse every chunk into its slot, skipping tokens beyond count
+		bool ok = true;
+		std::vector< const char* > ends( used, nullptr );
+		#pragma omp parallel for schedule( dynamic ) num_threads( numThreads ) reduction( && : ok )
+		for( int c=0; c<(int)used; c++ ) {
+			size_t index = counts[c];
+			size_t last = std::min( counts[c+1], count );
+			const char* p = bounds[c];
+			const char* e = bounds[c+1];
+			while( index < last ) {
+				while( isSpace( *p ) ) p++;
+				const char* token = p;
+				while( p != e && !isSpace( *p ) ) p++;
+				ok = parseNumber( std::string_view( token, p - token ), out[index++] ) && ok;
+			}
+			ends[c] = p;
+		}
+		if( !ok ) return false;
+
+		// the count-th token ends in the first chunk whose range reaches count
+		for( size_t c=0; c<used; c++ ) {
+			if( counts[c+1] >= count ) {
+				stop = ends[c];
+				break;
+			}
+		}
+		return true;
+	}
+
+	/// Checks whether the points of a curvilinear grid actually form an axis-aligned lattice,
+	/// i.e. point (i,j,k) lies at ( x[i], y[j], z[k] ). If so the grid is turned into a rectilinear
+	/// one, or a uniform one if every axis is equally spaced, and the point array is released.
+	/// tolerance is relative to the extent of the grid along each axis.
+	inline void detectRegularLayout( VtkDataset& data, double tolerance = 1e-5 ) {
+		if( data.layout != VtkLayout::Curvilinear ) return;
+
+		const size_t nx = data.dims[0], ny = data.dims[1], nz = data.dims[2];
+		const float* p = data.points.data();
+
+		// candidate axes: x varies with i, y with j, z with k
+		std::vector< float > axes[3] = { std::vector< float >( nx ), std::vector< float >( ny ), std::vector< float >( nz ) };
+		for( size_t i=0; i<nx; i++ ) axes[0][i] = p[ 3 * i ];
+		for( size_t j=0; j<ny; j++ ) axes[1][j] = p[ 3 * ( j * nx ) + 1 ];
+		for( size_t k=0; k<nz; k++ ) axes[2][k] = p[ 3 * ( k * nx * ny ) + 2 ];
+
+		double eps[3];
+		for( size_t d=0; d<3; d++ ) {
+			auto range = std::minmax_element( axes[d].begin(), axes[d].end() );
+			eps[d] = tolerance * std::max( double( *range.second - *range.first ), 1e-30 );
+		}
+
+		bool regular = true;
+		#pragma omp parallel for reduction( && : regular )
+		for( long long k=0; k<(long long)nz; k++ ) {
+			if( !regular ) continue;
+			for( size_t j=0; j<ny; j++ ) {
+				const float* row = p + 3 * ( ( k * ny + j ) * nx );
+				for( size_t i=0; i<nx; i++ ) {
+					regular = regular &&
+						std::abs( row[3*i+0] - axes[0][i] ) <= eps[0] &&
+						std::abs( row[3*i+1] - axes[1][j] ) <= eps[1] &&
+						std::abs( row[3*i+2] - axes[2][k] ) <= eps[2];
+				}
+			}
+		}
+		if( !regular ) return;
+
+		bool uniform = true;
+		for( size_t d=0; d<3 && uniform; d++ ) {
+			size_t n = axes[d].size();
+			double step = n > 1 ? ( double( axes[d][n-1] ) - axes[d][0] ) / ( n - 1 ) : 1.0;
+			for( size_t i=0; i<n && uniform; i++ ) {
+				uniform = std::abs( axes[d][0] + i * step - axes[d][i] ) <= eps[d];
+			}
+			data.origin[d] = axes[d][0];
+			data.spacing[d] = step;
+		}
+
+		if( uniform ) {
+			data.layout = VtkLayout::Uniform;
+		} else {
+			data.layout = VtkLayout::Rectilinear;
+			for( size_t d=0; d<3; d++ ) data.coordinates[d].swap( axes[d] );
+		}
+		std::vector< float >().swap( data.points );
+	}
+
+	/// Reader for legacy VTK STRUCTURED_GRID, RECTILINEAR_GRID and STRUCTURED_POINTS files in ASCII or BINARY format.
+	/// All POINT_DATA arrays (SCALARS, VECTORS, NORMALS and FIELD arrays) are read in one pass.
+	/// With one thread ASCII files are streamed. Otherwise they are memory-mapped and their numeric
+	/// sections are parsed in parallel. BINARY files are memory-mapped and byte-swapped in place.
+	class VtkLegacyReader {
+
+	public:
+		VtkLegacyReader() :
+#ifdef _OPENMP
+			m_numThreads( omp_get_max_threads() )
+#else
+			m_numThreads( 1 )
+#endif
+		{
+
+		}
+
+		/// Number of threads for parsing ASCII sections, values below 1 select all cores.
+		void setNumThreads( int numThreads ) {
+#ifdef _OPENMP
+			m_numThreads = numThreads > 0 ? numThreads : omp_get_max_threads();
+#else
+			m_numThreads = 1;
+#endif
+		}
+
+		/// Restricts reading to a sub-box of the grid. BINARY files only touch the selected rows,
+		/// ASCII files are still parsed completely but only the selected points are kept.
+		void setRegion( const VtkRegion& region ) {
+			m_region = region;
+		}
+
+		/// Reads the file at path into data. On failure error() describes the problem.
+		bool read( const std::string& path, VtkDataset& data ) {
+			VtkTokenizer tokenizer( path );
+			if( !tokenizer.isOpen() ) return fail( "Cannot open " + path );
+
+			std::string format;
+			if( !readHeader( tokenizer, format ) ) return false;
+			if( format == "ASCII" && m_numThreads == 1 ) return readBody( tokenizer, data, false );
+			if( format != "ASCII" && format != "BINARY" ) return fail( "Unsupported file format " + format );
+
+			MappedFile file( path );
+			if( !file.isOpen() ) return fail( "Cannot map " + path );
+			VtkTokenizer mapped( file.data(), file.data() + file.size() );
+			readHeader( mapped, format );
+			if( m_region.whole() ) file.adviseSequential( mapped.position() - file.data(), file.size() );
+			return readBody( mapped, data, format == "BINARY" );
+		}
+
+		const std::string& error() const {
+			return m_error;
+		}
+
+	private:
+		std::string m_error;
+		int m_numThreads;
+		VtkRegion m_region;
+		VtkRegion m_active;
+
+		bool fail( const std::string& message ) {
+			m_error = message;
+			return false;
+		}
+
+		// version line, title line, file format
+		bool readHeader( VtkTokenizer& tokenizer, std::string& format ) {
+			std::string line;
+			if( !tokenizer.readLine( line ) || line.find( "vtk DataFile" ) == std::string::npos ) {
+				return fail( "Not a legacy VTK file" );
+			}
+			tokenizer.readLine( line );
+
+			std::string_view token;
+			if( !tokenizer.next( token ) ) return fail( "Unexpected end of file" );
+			format = std::string( token );
+			return true;
+		}
+
+		bool readBody( VtkTokenizer& tokenizer, VtkDataset& data, bool binary ) {
+			std::string_view token;
+			while( tokenizer.next( token ) ) {
+				if( token == "DATASET" ) {
+					if( !tokenizer.next( token ) ) return fail( "Unexpected end of file" );
+					if( token == "STRUCTURED_POINTS" ) data.layout = VtkLayout::Uniform;
+					else if( token == "RECTILINEAR_GRID" ) data.layout = VtkLayout::Rectilinear;
+					else if( token != "STRUCTURED_GRID" ) return fail( "Unsupported dataset " + std::string( token ) );
+				} else if( token == "DIMENSIONS" ) {
+					if( !tokenizer.parse( data.dims, 3 ) ) return fail( "Invalid DIMENSIONS" );
+					data.numPoints = data.dims[0] * data.dims[1] * data.dims[2];
+					m_active = m_region;
+					if( !m_active.fit( data.dims ) ) return fail( "Region lies outside the grid" );
+				} else if( token == "ORIGIN" ) {
+					if( !tokenizer.parse( data.origin, 3 ) ) return fail( "Invalid ORIGIN" );
+				} else if( token == "SPACING" || token == "ASPECT_RATIO" ) {
+					if( !tokenizer.parse( data.spacing, 3 ) ) return fail( "Invalid SPACING" );
+				} else if( token == "X_COORDINATES" || token == "Y_COORDINATES" || token == "Z_COORDINATES" ) {
+					std::vector< float >& coords = data.coordinates[ token[0] - 'X' ];
+					size_t count;
+					if( !tokenizer.parse( &count, 1 ) || !tokenizer.next( token ) ) return fail( "Invalid coordinates" );
+					coords.resize( count );
+					if( !readArray( tokenizer, binary, token, coords.data(), count, "coordinates" ) ) return false;
+				} else if( token == "POINTS" ) {
+					size_t count;
+					if( !tokenizer.parse( &count, 1 ) || !tokenizer.next( token ) || count != data.numPoints || count == 0 ) return fail( "Invalid POINTS" );
+					data.points.resize( m_active.numPoints() * 3 );
+					if( !readGridArray( tokenizer, binary, token, data.dims, 3, data.points.data(), "point coordinates" ) ) return false;
+				} else if( token == "POINT_DATA" ) {
+					size_t numValues;
+					if( !tokenizer.parse( &numValues, 1 ) || numValues != data.numPoints || numValues == 0 ) return fail( "Invalid POINT_DATA" );
+				} else if( token == "VECTORS" || token == "NORMALS" || token == "SCALARS" ) {
+					bool isVector = token != "SCALARS";
+					VtkArray array;
+					if( !tokenizer.next( token ) ) return fail( "Unexpected end of file" );
+					array.name = std::string( token );
+					if( !tokenizer.next( token ) ) return fail( "Unexpected end of file" );
+					std::string type( token );
+
+					array.numComponents = isVector ? 3 : 1;
+					if( !isVector ) {
+						// optional component count, then the lookup table
+						if( !tokenizer.next( token ) ) return fail( "Unexpected end of file" );
+						if( token != "LOOKUP_TABLE" ) {
+							if( !parseNumber( token, array.numComponents ) ) return fail( "Invalid SCALARS" );
+							if( !tokenizer.next( token ) || token != "LOOKUP_TABLE" ) return fail( "Missing LOOKUP_TABLE" );
+						}
+						tokenizer.next( token );
+					}
+					if( !readPointArray( tokenizer, binary, type, data, array ) ) return false;
+				} else if( token == "FIELD" ) {
+					// FIELD name count, then per array: name components tuples type
+					size_t count;
+					if( !tokenizer.next( token ) || !tokenizer.parse( &count, 1 ) ) return fail( "Invalid FIELD" );
+					for( size_t a=0; a<count; a++ ) {
+						VtkArray array;
+						size_t tuples;
+						if( !tokenizer.next( token ) ) return fail( "Unexpected end of file" );
+						array.name = std::string( token );
+						if( !tokenizer.parse( &array.numComponents, 1 ) || !tokenizer.parse( &tuples, 1 ) || !tokenizer.next( token ) ) return fail( "Invalid FIELD array " + array.name );
+						if( tuples != data.numPoints ) return fail( "FIELD array " + array.name + " doesn't match POINT_DATA" );
+						if( !readPointArray( tokenizer, binary, token, data, array ) ) return false;
+					}
+				} else if( token == "CELL_DATA" ) {
+					// cell arrays are not supported and always follow the grid
+					break;
+				} else {
+					return fail( "Unsupported keyword " + std::string( token ) );
+				}
+			}
+
+			if( data.numPoints == 0 ) return fail( "File contains no points" );
+			switch( data.layout ) {
+			case VtkLayout::Curvilinear:
+				if( data.points.empty() ) return fail( "File contains no points" );
+				break;
+			case VtkLayout::Rectilinear:
+				for( size_t d=0; d<3; d++ ) {
+					if( data.coordinates[d].size() != data.dims[d] ) return fail( "Coordinates don't match DIMENSIONS" );
+				}
+				break;
+			case VtkLayout::Uniform:
+				break;
+			}
+			if( !m_active.covers( data.dims ) ) cropLattice( data, m_active );
+			return true;
+		}
+
+		// Reads the values of array and appends it to the arrays of data.
+		bool readPointArray( VtkTokenizer& tokenizer, bool binary, std::string_view type, VtkDataset& data, VtkArray& array ) {
+			if( data.numPoints == 0 || array.numComponents == 0 ) return fail( "Invalid array " + array.name );
+			array.values.resize( m_active.numPoints() * array.numComponents );
+			if( !readGridArray( tokenizer, binary, type, data.dims, array.numComponents, array.values.data(), "values of " + array.name ) ) return false;
+			data.arrays.push_back( std::move( array ) );
+			return true;
+		}
+
+		static bool binaryValueSize( std::string_view type, size_t& size ) {
+			if( type == "float" ) size = sizeof( float );
+			else if( type == "double" ) size = sizeof( double );
+			else return false;
+			return true;
+		}
+
+		// Reads count values of the given VTK data type. In BINARY files the block starts
+		// on the line after its header and is stored big-endian.
+		bool readArray( VtkTokenizer& tokenizer, bool binary, std::string_view type, float* out, size_t count, const std::string& what ) {
+			if( !binary ) {
+				if( m_numThreads == 1 ) return tokenizer.parse( out, count ) || fail( "Invalid " + what );
+
+				const char* stop = nullptr;
+				if( !parseNumbersParallel( tokenizer.position(), tokenizer.end(), out, count, m_numThreads, stop ) ) return fail( "Invalid " + what );
+				tokenizer.seek( stop );
+				return true;
+			}
+
+			size_t size;
+			if( !binaryValueSize( type, size ) ) return fail( "Unsupported binary data type " + std::string( type ) );
+
+			std::string rest;
+			tokenizer.readLine( rest );
+			const char* begin = tokenizer.position();
+			if( size_t( tokenizer.end() - begin ) < count * size ) return fail( "Truncated " + what );
+
+			if( size == sizeof( float ) ) loadBigEndian< float >( begin, out, count );
+			else loadBigEndian< double >( begin, out, count );
+			tokenizer.seek( begin + count * size );
+			return true;
+		}
+
+		// Reads an array with components values for each point of a grid of dims points and keeps
+		// the points of the active region. In BINARY files only the selected rows are converted.
+		bool readGridArray( VtkTokenizer& tokenizer, bool binary, std::string_view type, const size_t dims[3], size_t components, float* out, const std::string& what ) {
+			const size_t total = dims[0] * dims[1] * dims[2] * components;
+			if( m_active.covers( dims ) ) return readArray( tokenizer, binary, type, out, total, what );
+
+			if( !binary ) {
+				// text can't be indexed, so parse it row by row and copy the selected points
+				const size_t nx = m_active.count( 0 ), ny = m_active.count( 1 );
+				std::vector< float > row( dims[0] * components );
+				for( size_t k=0; k<dims[2]; k++ ) {
+					bool selectedK = k >= m_active.begin[2] && k <= m_active.end[2] && ( k - m_active.begin[2] ) % m_active.stride[2] == 0;
+					for( size_t j=0; j<dims[1]; j++ ) {
+						if( !tokenizer.parse( row.data(), row.size() ) ) return fail( "Invalid " + what );
+						if( !selectedK || j < m_active.begin[1] || j > m_active.end[1] || ( j - m_active.begin[1] ) % m_active.stride[1] != 0 ) continue;
+
+						size_t target = ( ( k - m_active.begin[2] ) / m_active.stride[2] * ny + ( j - m_active.begin[1] ) / m_active.stride[1] ) * nx;
+						for( size_t i=0; i<nx; i++ ) {
+							std::memcpy( out + ( target + i ) * components, row.data() + ( m_active.begin[0] + i * m_active.stride[0] ) * components, components * sizeof( float ) );
+						}
+					}
+				}
+				return true;
+			}
+
+			size_t size;
+			if( !binaryValueSize( type, size ) ) return fail( "Unsupported binary data type " + std::string( type ) );
+
+			std::string rest;
+			tokenizer.readLine( rest );
+			const char* begin = tokenizer.position();
+			if( size_t( tokenizer.end() - begin ) < total * size ) return fail( "Truncated " + what );
+
+			gatherRegion( m_active, dims, components, out, [begin, size]( size_t first, size_t count, float* target ) {
+				if( size == sizeof( float ) ) loadBigEndian< float >( begin + first * size, target, count );
+				else loadBigEndian< double >( begin + first * size, target, count );
+			} );
+			tokenizer.seek( begin + total * size );
+			return true;
+		}
+	};
+}
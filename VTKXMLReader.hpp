@@ -0,0 +1,272 @@
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <zlib.h>
+
+#include "ByteSwap.hpp"
+#include "MappedFile.hpp"
+#include "VTKReader.hpp"
+
+namespace fantom
+{
+
+	/// Finds the opening tag <name ...> at or behind from. Returns the position behind its
+	/// '<' (never 0) or 0 if there is none.
+	inline size_t findXmlTag( std::string_view xml, std::string_view name, size_t from, std::string_view& tag ) {
+		for( size_t pos = xml.find( '<', from ); pos != std::string_view::npos; pos = xml.find( '<', pos + 1 ) ) {
+			if( xml.compare( pos + 1, name.size(), name ) != 0 ) continue;
+			char next = pos + 1 + name.size() < xml.size() ? xml[ pos + 1 + name.size() ] : '>';
+			if( next != ' ' && next != '>' && next != '/' && next != '\n' && next != '\t' && next != '\r' ) continue;
+			size_t close = xml.find( '>', pos );
+			if( close == std::string_view::npos ) return 0;
+			tag = xml.substr( pos, close - pos + 1 );
+			return pos + 1;
+		}
+		return 0;
+	}
+
+	/// Value of the attribute name of an opening tag, empty if it is missing.
+	inline std::string_view xmlAttribute( std::string_view tag, std::string_view name ) {
+		for( size_t pos = tag.find( name ); pos != std::string_view::npos; pos = tag.find( name, pos + 1 ) ) {
+			size_t eq = pos + name.size();
+			if( pos == 0 || !std::isspace( tag[pos-1] ) || eq + 1 >= tag.size() || tag[eq] != '=' ) continue;
+			char quote = tag[eq+1];
+			size_t close = tag.find( quote, eq + 2 );
+			if( close == std::string_view::npos ) return std::string_view();
+			return tag.substr( eq + 2, close - eq - 2 );
+		}
+		return std::string_view();
+	}
+
+	/// Parses count whitespace separated numbers, e.g. from an attribute value.
+	template< typename T >
+	inline bool parseNumberList( std::string_view list, T* out, size_t count ) {
+		size_t pos = 0;
+		for( size_t i=0; i<count; i++ ) {
+			pos = list.find_first_not_of( " \t\n\r", pos );
+			if( pos == std::string_view::npos ) return false;
+			size_t end = std::min( list.find_first_of( " \t\n\r", pos ), list.size() );
+			if( !parseNumber( list.substr( pos, end - pos ), out[i] ) ) return false;
+			pos = end;
+		}
+		return true;
+	}
+
+	/// Reader for serial VTK XML image data (.vti), rectilinear (.vtr) and structured (.vts) grids
+	/// whose arrays are stored in the appended section, either raw or zlib-compressed.
+	/// The appended section is read straight from a memory mapping and compressed blocks are
+	/// inflated in parallel into the output arrays.
+	class VtkXmlReader {
+
+	public:
+		/// Reads the file at path into data. On failure error() describes the problem.
+		bool read( const std::string& path, VtkDataset& data ) {
+			MappedFile file( path );
+			if( !file.isOpen() ) return fail( "Cannot open " + path );
+
+			// the XML part ends where the appended data begins
+			std::string_view text( file.data(), file.size() );
+			size_t appended = text.find( "<AppendedData" );
+			std::string_view xml = text.substr( 0, appended );
+
+			std::string_view root;
+			if( !findXmlTag( xml, "VTKFile", 0, root ) ) return fail( "Not a VTK XML file" );
+			std::string type( xmlAttribute( root, "type" ) );
+			m_bigEndian = xmlAttribute( root, "byte_order" ) == "BigEndian";
+			m_header64 = xmlAttribute( root, "header_type" ) == "UInt64";
+			std::string_view compressor = xmlAttribute( root, "compressor" );
+			m_compressed = !compressor.empty();
+			if( m_compressed && compressor != "vtkZLibDataCompressor" ) return fail( "Unsupported compressor " + std::string( compressor ) );
+
+			std::string_view dataset;
+			if( type == "ImageData" ) data.layout = VtkLayout::Uniform;
+			else if( type == "RectilinearGrid" ) data.layout = VtkLayout::Rectilinear;
+			else if( type == "StructuredGrid" ) data.layout = VtkLayout::Curvilinear;
+			else return fail( "Unsupported dataset " + type );
+			if( !findXmlTag( xml, type, 0, dataset ) ) return fail( "Missing " + type + " element" );
+
+			long long extent[6];
+			if( !parseNumberList( xmlAttribute( dataset, "WholeExtent" ), extent, 6 ) ) return fail( "Invalid WholeExtent" );
+			for( size_t d=0; d<3; d++ ) data.dims[d] = extent[2*d+1] - extent[2*d] + 1;
+			data.numPoints = data.dims[0] * data.dims[1] * data.dims[2];
+
+			std::string_view piece;
+			size_t piecePos = findXmlTag( xml, "Piece", 0, piece );
+			if( !piecePos ) return fail( "Missing Piece element" );
+			if( findXmlTag( xml, "Piece", piecePos + 1, piece ) ) return fail( "Files with several pieces are not supported" );
+
+			// the appended data starts behind the '_' marker
+			if( appended != std::string_view::npos ) {
+				std::string_view appendedTag;
+				findXmlTag( text, "AppendedData", appended, appendedTag );
+				if( xmlAttribute( appendedTag, "encoding" ) != "raw" ) return fail( "Only raw appended data is supported" );
+				size_t marker = text.find( '_', appended + appendedTag.size() );
+				if( marker == std::string_view::npos ) return fail( "Missing appended data marker" );
+				m_appended = file.data() + marker + 1;
+				m_end = file.data() + file.size();
+			}
+
+			if( data.layout == VtkLayout::Uniform ) {
+				double origin[3] = { 0.0, 0.0, 0.0 };
+				double spacing[3] = { 1.0, 1.0, 1.0 };
+				parseNumberList( xmlAttribute( dataset, "Origin" ), origin, 3 );
+				parseNumberList( xmlAttribute( dataset, "Spacing" ), spacing, 3 );
+				for( size_t d=0; d<3; d++ ) {
+					data.origin[d] = origin[d] + extent[2*d] * spacing[d];
+					data.spacing[d] = spacing[d];
+				}
+			} else if( data.layout == VtkLayout::Rectilinear ) {
+				size_t pos = xml.find( "<Coordinates" );
+				if( pos == std::string_view::npos ) return fail( "Missing Coordinates element" );
+				for( size_t d=0; d<3; d++ ) {
+					std::string_view array;
+					pos = findXmlTag( xml, "DataArray", pos + 1, array );
+					if( !pos ) return fail( "Missing coordinate array" );
+					data.coordinates[d].resize( data.dims[d] );
+					if( !readArray( array, data.coordinates[d].data(), data.dims[d] ) ) return false;
+				}
+			} else {
+				size_t pos = xml.find( "<Points" );
+				std::string_view array;
+				if( pos == std::string_view::npos || !findXmlTag( xml, "DataArray", pos, array ) ) return fail( "Missing Points element" );
+				data.points.resize( data.numPoints * 3 );
+				if( !readArray( array, data.points.data(), data.points.size() ) ) return false;
+			}
+
+			// all point data arrays
+			size_t pos = xml.find( "<PointData" );
+			size_t end = xml.find( "</PointData>" );
+			if( pos == std::string_view::npos || end == std::string_view::npos ) return fail( "File contains no point data" );
+			std::string_view tag;
+			for( pos = findXmlTag( xml, "DataArray", pos, tag ); pos && pos < end; pos = findXmlTag( xml, "DataArray", pos, tag ) ) {
+				VtkArray array;
+				array.name = std::string( xmlAttribute( tag, "Name" ) );
+				array.numComponents = 1;
+				parseNumberList( xmlAttribute( tag, "NumberOfComponents" ), &array.numComponents, 1 );
+				array.values.resize( data.numPoints * array.numComponents );
+				if( !readArray( tag, array.values.data(), array.values.size() ) ) return false;
+				data.arrays.push_back( std::move( array ) );
+			}
+			return !data.arrays.empty() || fail( "File contains no point data" );
+		}
+
+		const std::string& error() const {
+			return m_error;
+		}
+
+	private:
+		std::string m_error;
+		bool m_bigEndian = false;
+		bool m_header64 = false;
+		bool m_compressed = false;
+		const char* m_appended = nullptr;
+		const char* m_end = nullptr;
+
+		bool fail( const std::string& message ) {
+			m_error = message;
+			return false;
+		}
+
+		uint64_t readHeaderValue( const char* p ) const {
+			if( m_header64 ) {
+				uint64_t value;
+				std::memcpy( &value, p, 8 );
+				return needsSwap() ? __builtin_bswap64( value ) : value;
+			}
+			uint32_t value;
+			std::memcpy( &value, p, 4 );
+			return needsSwap() ? __builtin_bswap32( value ) : value;
+		}
+
+		// Reads an appended DataArray of count values into out.
+		bool readArray( std::string_view array, float* out, size_t count ) {
+			if( xmlAttribute( array, "format" ) != "appended" ) return fail( "Only appended arrays are supported" );
+			if( !m_appended ) return fail( "Missing appended data" );
+
+			std::string_view type = xmlAttribute( array, "type" );
+			size_t size;
+			if( type == "Float32" ) size = sizeof( float );
+			else if( type == "Float64" ) size = sizeof( double );
+			else return fail( "Unsupported array type " + std::string( type ) );
+
+			size_t offset;
+			if( !parseNumberList( xmlAttribute( array, "offset" ), &offset, 1 ) ) return fail( "Invalid array offset" );
+			// the offset and every size come from the file, so they are checked against the bytes
+			// left in the appended section before anything is read from there
+			size_t headerSize = m_header64 ? 8 : 4;
+			size_t available = m_end - m_appended;
+			if( offset > available || available - offset < headerSize ) return fail( "Array offset lies outside of the appended data" );
+			const char* begin = m_appended + offset;
+			available -= offset + headerSize;
+
+			if( !m_compressed ) {
+				uint64_t bytes = readHeaderValue( begin );
+				if( bytes != count * size ) return fail( "Array size doesn't match the grid" );
+				if( bytes > available ) return fail( "Truncated appended data" );
+				convert( begin + headerSize, size, out, count );
+				return true;
+			}
+
+			// header: number of blocks, uncompressed block size, size of the last block,
+			// then the compressed size of every block
+			uint64_t numBlocks = readHeaderValue( begin );
+			if( available / headerSize < 2 || numBlocks > available / headerSize - 2 ) return fail( "Truncated compression header" );
+			available -= headerSize * ( 2 + numBlocks );
+			uint64_t blockSize = readHeaderValue( begin + headerSize );
+			uint64_t lastBlockSize = readHeaderValue( begin + 2 * headerSize );
+			if( numBlocks > 0 && ( blockSize == 0 || lastBlockSize > blockSize ) ) return fail( "Invalid compression header" );
+			uint64_t total = numBlocks == 0 ? 0 : ( numBlocks - 1 ) * blockSize + ( lastBlockSize ? lastBlockSize : blockSize );
+			if( total != count * size || ( numBlocks > 0 && blockSize % size != 0 ) ) return fail( "Array size doesn't match the grid" );
+
+			std::vector< uint64_t > sources( numBlocks + 1 );
+			sources[0] = 0;
+			for( size_t b=0; b<numBlocks; b++ ) {
+				uint64_t compressed = readHeaderValue( begin + headerSize * ( 3 + b ) );
+				if( compressed > available - sources[b] ) return fail( "Truncated compressed data" );
+				sources[b+1] = sources[b] + compressed;
+			}
+			const char* blocks = begin + headerSize * ( 3 + numBlocks );
+
+			// inflate straight into the output if no conversion is needed
+			bool direct = size == sizeof( float ) && !needsSwap();
+			bool ok = true;
+			#pragma omp parallel reduction( && : ok )
+			{
+				std::vector< char > buffer( direct ? 0 : blockSize );
+
+				#pragma omp for schedule( dynamic )
+				for( long long b=0; b<(long long)numBlocks; b++ ) {
+					uLongf length = b + 1 == (long long)numBlocks ? total - b * blockSize : blockSize;
+					uLongf expected = length;
+					Bytef* target = direct ? reinterpret_cast< Bytef* >( out ) + b * blockSize : reinterpret_cast< Bytef* >( buffer.data() );
+					const Bytef* source = reinterpret_cast< const Bytef* >( blocks + sources[b] );
+					if( uncompress( target, &length, source, sources[b+1] - sources[b] ) != Z_OK || length != expected ) {
+						ok = false;
+						continue;
+					}
+					if( !direct ) convert( buffer.data(), size, out + b * blockSize / size, length / size );
+				}
+			}
+			return ok || fail( "Corrupt compressed data" );
+		}
+
+		bool needsSwap() const {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			return !m_bigEndian;
+#else
+			return m_bigEndian;
+#endif
+		}
+
+		void convert( const char* src, size_t size, float* out, size_t count ) const {
+			if( size == sizeof( float ) ) loadValues< float >( src, out, count, m_bigEndian );
+			else loadValues< double >( src, out, count, m_bigEndian );
+		}
+	};
+}
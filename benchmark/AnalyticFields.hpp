@@ -0,0 +1,136 @@
+#pragma once
+
+// The vector type, analytic flows and grid sampling the benchmarks share. Header only and
+// without fantom, like the benchmarks that include it.
+
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "../StructuredGrid.hpp"
+
+namespace benchmark
+{
+
+	struct Vec3 {
+		double x, y, z;
+	};
+
+	inline Vec3 operator+( const Vec3& a, const Vec3& b ) {
+		return Vec3{ a.x + b.x, a.y + b.y, a.z + b.z };
+	}
+
+	inline Vec3 operator-( const Vec3& a, const Vec3& b ) {
+		return Vec3{ a.x - b.x, a.y - b.y, a.z - b.z };
+	}
+
+	inline Vec3 operator*( double s, const Vec3& a ) {
+		return Vec3{ s * a.x, s * a.y, s * a.z };
+	}
+
+	inline double operator*( const Vec3& a, const Vec3& b ) {
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	inline double norm( const Vec3& a ) {
+		return std::sqrt( a.x * a.x + a.y * a.y + a.z * a.z );
+	}
+
+	inline Vec3 normalized( const Vec3& a ) {
+		return ( 1.0 / norm( a ) ) * a;
+	}
+
+	const double pi = 3.14159265358979323846;
+
+	/// Solid-body rotation about z.
+	inline Vec3 rotation( const Vec3& p ) {
+		return Vec3{ -p.y, p.x, 0.0 };
+	}
+
+	/// Arnold-Beltrami-Childress flow with A = sqrt(3), B = sqrt(2), C = 1.
+	inline Vec3 abc( const Vec3& p ) {
+		const double a = std::sqrt( 3.0 ), b = std::sqrt( 2.0 ), c = 1.0;
+		return Vec3{ a * std::sin( p.z ) + c * std::cos( p.y ), b * std::sin( p.x ) + a * std::cos( p.z ), c * std::sin( p.y ) + b * std::cos( p.x ) };
+	}
+
+	/// Steady double gyre with A = 0.1.
+	inline Vec3 doubleGyre( const Vec3& p ) {
+		const double A = 0.1;
+		return Vec3{ -pi * A * std::sin( pi * p.x ) * std::cos( pi * p.y ), pi * A * std::cos( pi * p.x ) * std::sin( pi * p.y ), 0.0 };
+	}
+
+	/// An analytic field with its domain, integration time and the box the seeds are drawn from.
+	struct Flow {
+		const char* name;
+		std::function< Vec3( const Vec3& ) > velocity;
+		Vec3 lower, upper;
+		Vec3 seedLower, seedUpper;
+		double duration;
+	};
+
+	/// The rotation in [-1,1]^3 for one revolution.
+	inline Flow rotationFlow() {
+		return Flow{ "rotation", rotation, Vec3{ -1.0, -1.0, -1.0 }, Vec3{ 1.0, 1.0, 1.0 }, Vec3{ 0.1, 0.1, -0.8 }, Vec3{ 0.6, 0.6, 0.8 }, 2.0 * pi };
+	}
+
+	/// The ABC flow in [0,2pi]^3 for time 0.5.
+	inline Flow abcFlow() {
+		return Flow{ "abc", abc, Vec3{ 0.0, 0.0, 0.0 }, Vec3{ 2.0 * pi, 2.0 * pi, 2.0 * pi }, Vec3{ 2.2, 2.2, 2.2 }, Vec3{ 4.1, 4.1, 4.1 }, 0.5 };
+	}
+
+	/// The double gyre in [0,2]x[0,1]x[0,1] for time 10.
+	inline Flow doubleGyreFlow() {
+		return Flow{ "double-gyre", doubleGyre, Vec3{ 0.0, 0.0, 0.0 }, Vec3{ 2.0, 1.0, 1.0 }, Vec3{ 0.1, 0.1, 0.2 }, Vec3{ 1.9, 0.9, 0.8 }, 10.0 };
+	}
+
+	inline std::vector< Flow > flows() {
+		return { rotationFlow(), abcFlow(), doubleGyreFlow() };
+	}
+
+	/// The analytic field as integration core field.
+	struct AnalyticField {
+		const Flow& flow;
+
+		bool operator()( const Vec3& p, Vec3& v ) const {
+			v = flow.velocity( p );
+			return true;
+		}
+	};
+
+	/// Samples flow at the points of an n^3 grid over its domain. A curvilinear grid displaces
+	/// the inner points by up to a third of a cell, smoothly, so cells stay convex.
+	inline std::shared_ptr< const fantom::StructuredVectorField > sample( const Flow& flow, size_t n, bool curvilinear ) {
+		const size_t dims[3] = { n, n, n };
+		const double lower[3] = { flow.lower.x, flow.lower.y, flow.lower.z };
+		const double upper[3] = { flow.upper.x, flow.upper.y, flow.upper.z };
+		std::vector< double > coordinates[3];
+		std::vector< double > values[3];
+		for( size_t d=0; d<3; d++ ) {
+			coordinates[d].resize( n * n * n );
+			values[d].resize( n * n * n );
+		}
+		for( size_t k=0; k<n; k++ ) {
+			for( size_t j=0; j<n; j++ ) {
+				for( size_t i=0; i<n; i++ ) {
+					const size_t index = ( k * n + j ) * n + i;
+					const double u[3] = { double( i ) / ( n - 1 ), double( j ) / ( n - 1 ), double( k ) / ( n - 1 ) };
+					const double bump = std::sin( pi * u[0] ) * std::sin( pi * u[1] ) * std::sin( pi * u[2] );
+					double p[3];
+					for( size_t d=0; d<3; d++ ) {
+						const double h = ( upper[d] - lower[d] ) / ( n - 1 );
+						p[d] = lower[d] + u[d] * ( upper[d] - lower[d] );
+						if( curvilinear ) p[d] += h / 3.0 * bump * std::sin( 2.0 * pi * ( u[ ( d + 1 ) % 3 ] + 0.25 * d ) );
+						coordinates[d][index] = p[d];
+					}
+					const Vec3 v = flow.velocity( Vec3{ p[0], p[1], p[2] } );
+					values[0][index] = v.x;
+					values[1][index] = v.y;
+					values[2][index] = v.z;
+				}
+			}
+		}
+		auto grid = std::make_shared< const fantom::StructuredGrid >( dims, std::move( coordinates[0] ), std::move( coordinates[1] ), std::move( coordinates[2] ) );
+		return std::make_shared< const fantom::StructuredVectorField >( grid, values );
+	}
+}
@@ -0,0 +1,148 @@
+// Compares point location on a curvilinear grid with and without the cell locator.
+//
+// Build and run without fantom:
+//   g++ -std=c++17 -O2 -fopenmp -I.. LocateBenchmark.cpp -o locate-bench
+//   ./locate-bench [gridSize] [numQueries]
+//
+// The grid is a gridSize^3 lattice whose points are displaced by a smooth wave, so no cell is
+// axis-aligned. The baseline is a brute-force linear scan over the bounding boxes of all cells
+// with the same exact containment test. It is not fantom's Grid::locate, which can't be called
+// without fantom, so the column "vs scan" shows how much work the bins save over testing every
+// cell, not the gain over the locate() the plugins used before. Variants:
+//   scan      brute force: bounding box test of every cell, exact test of the candidates
+//   locator   CellLocator lookup without a hint, as for seeds and restarted particles; the
+//             locator is built on the first lookup, which is timed separately
+//   walk      walk from the previous query, which moves a small distance like a streamline
+// Results of the locator are checked against the scan.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "../StructuredGrid.hpp"
+
+using namespace fantom;
+
+namespace {
+
+	double seconds( std::chrono::steady_clock::time_point start ) {
+		return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+	}
+
+	// Point (i,j,k) of the wavy lattice over [0,1]^3.
+	void wavyPoint( double i, double j, double k, size_t n, double p[3] ) {
+		const double h = 1.0 / ( n - 1 );
+		const double a = 0.3 * h;
+		p[0] = i * h + a * std::sin( 7.0 * j * h + 3.0 * k * h );
+		p[1] = j * h + a * std::sin( 5.0 * k * h + 4.0 * i * h );
+		p[2] = k * h + a * std::cos( 6.0 * i * h + 2.0 * j * h );
+	}
+
+	// Cell whose bounding box and exact test contain p, by testing every cell.
+	size_t scan( const StructuredGrid& grid, const double p[3], double local[3] ) {
+		for( size_t cell=0; cell<grid.numCells(); cell++ ) {
+			size_t c[3];
+			grid.cellCoordinates( cell, c );
+			bool outside = false;
+			for( size_t d=0; d<3 && !outside; d++ ) {
+				double lower = HUGE_VAL, upper = -HUGE_VAL;
+				for( size_t v=0; v<8; v++ ) {
+					double x = grid.point( grid.pointIndex( c[0] + ( v & 1 ), c[1] + ( ( v >> 1 ) & 1 ), c[2] + ( v >> 2 ) ), d );
+					lower = std::min( lower, x );
+					upper = std::max( upper, x );
+				}
+				outside = p[d] < lower || p[d] > upper;
+			}
+			if( !outside && grid.contains( cell, p, local ) ) return cell;
+		}
+		return StructuredGrid::none;
+	}
+}
+
+int main( int argc, char** argv ) {
+	size_t gridSize = argc > 1 ? std::atoi( argv[1] ) : 64;
+	size_t numQueries = argc > 2 ? std::atoi( argv[2] ) : 200000;
+	size_t numScans = std::max< size_t >( numQueries / 1000, 20 );
+
+	size_t dims[3] = { gridSize, gridSize, gridSize };
+	std::vector< double > coordinates[3];
+	for( size_t d=0; d<3; d++ ) coordinates[d].resize( gridSize * gridSize * gridSize );
+	for( size_t k=0; k<gridSize; k++ ) {
+		for( size_t j=0; j<gridSize; j++ ) {
+			for( size_t i=0; i<gridSize; i++ ) {
+				double p[3];
+				wavyPoint( i, j, k, gridSize, p );
+				size_t index = i + gridSize * ( j + gridSize * k );
+				for( size_t d=0; d<3; d++ ) coordinates[d][index] = p[d];
+			}
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	StructuredGrid grid( dims, coordinates[0], coordinates[1], coordinates[2] );
+	double build = seconds( start );
+	double local[3];
+	size_t first = StructuredGrid::none;
+	const double center[3] = { 0.5, 0.5, 0.5 };
+	start = std::chrono::steady_clock::now();
+	grid.locate( center, first, local );
+	double locator = seconds( start );
+	std::printf( "grid %zu^3 (%zu cells) built in %.3f s, locator in %.3f s\n", gridSize, grid.numCells(), build, locator );
+
+	// queries at lattice parameters inside the grid, mapped through the wave
+	std::mt19937 random( 1 );
+	std::uniform_real_distribution< double > parameter( 0.5, gridSize - 1.5 );
+	std::vector< double > queries( 3 * numQueries );
+	for( size_t q=0; q<numQueries; q++ ) wavyPoint( parameter( random ), parameter( random ), parameter( random ), gridSize, &queries[3*q] );
+
+	// a particle path with steps of a fifth of a cell
+	std::vector< double > path( 3 * numQueries );
+	double u[3] = { 0.5 * gridSize, 0.5 * gridSize, 0.5 * gridSize };
+	std::normal_distribution< double > step( 0.0, 0.2 );
+	for( size_t q=0; q<numQueries; q++ ) {
+		for( size_t d=0; d<3; d++ ) u[d] = std::min( std::max( u[d] + step( random ), 0.5 ), gridSize - 1.5 );
+		wavyPoint( u[0], u[1], u[2], gridSize, &path[3*q] );
+	}
+
+	std::printf( "%8s %10s %14s %8s\n", "variant", "queries", "lookups/s", "vs scan" );
+
+	std::vector< size_t > scanned( numScans );
+	start = std::chrono::steady_clock::now();
+	for( size_t q=0; q<numScans; q++ ) scanned[q] = scan( grid, &queries[3*q], local );
+	double scanRate = numScans / seconds( start );
+	std::printf( "%8s %10zu %14.0f %8.1f\n", "scan", numScans, scanRate, 1.0 );
+
+	std::vector< size_t > located( numQueries );
+	size_t missing = 0;
+	start = std::chrono::steady_clock::now();
+	for( size_t q=0; q<numQueries; q++ ) {
+		located[q] = StructuredGrid::none;
+		if( !grid.locate( &queries[3*q], located[q], local ) ) missing++;
+	}
+	double locatorRate = numQueries / seconds( start );
+	std::printf( "%8s %10zu %14.0f %8.1f", "locator", numQueries, locatorRate, locatorRate / scanRate );
+	size_t different = 0;
+	for( size_t q=0; q<numScans; q++ ) {
+		// points on a shared face may be found in either cell, both cells passed the exact test
+		if( ( located[q] == StructuredGrid::none ) != ( scanned[q] == StructuredGrid::none ) ) different++;
+	}
+	if( missing || different ) std::printf( "  %zu not found, %zu differ from scan", missing, different );
+	std::printf( "\n" );
+
+	size_t cell = StructuredGrid::none;
+	missing = 0;
+	start = std::chrono::steady_clock::now();
+	for( size_t q=0; q<numQueries; q++ ) {
+		if( !grid.locate( &path[3*q], cell, local ) ) missing++;
+	}
+	double walkRate = numQueries / seconds( start );
+	std::printf( "%8s %10zu %14.0f %8.1f", "walk", numQueries, walkRate, walkRate / scanRate );
+	if( missing ) std::printf( "  %zu not found", missing );
+	std::printf( "\n" );
+
+	return 0;
+}
@@ -0,0 +1,178 @@
+// Compares the scheduling of streamlines of very different lengths over the threads.
+//
+// Build and run without fantom:
+//   g++ -std=c++17 -O2 -fopenmp -I.. SchedulingBenchmark.cpp -o scheduling-bench
+//   OMP_NUM_THREADS=8 ./scheduling-bench [numSeeds] [maxSteps]
+//
+// The field moves particles along x out of the unit cube with a speed that falls off by three
+// orders of magnitude across y, so line lengths range from a hundred steps to maxSteps. The
+// seeds are sorted by length with the longest last, the worst case for handing out seeds in
+// order. Variants integrate the same seeds with RK4:
+//   static   #pragma omp for with the default static schedule
+//   dynamic  #pragma omp for schedule( dynamic ), as the integrators used before the pool
+//   pool     integrateLines, lines in slices of 256 steps on the work-stealing TaskPool
+// "ideal" is the serial time divided by the threads, or the longest line if that takes longer.
+// The machine needs at least as many cores as threads for the times to mean anything.
+//
+// A second run keeps all positions on the pool, as the integrators do, and compares collecting
+// them in a vector per line that is then copied into one array, against a LineArena and merge().
+// The merged lines are then simplified with simplifyLines to a tolerance of 1e-4.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <omp.h>
+
+#include "../IntegrationCore.hpp"
+#include "../IntegrationTasks.hpp"
+#include "../LineArena.hpp"
+#include "../LineSimplification.hpp"
+#include "AnalyticFields.hpp"
+
+using namespace fantom;
+using namespace benchmark;
+
+namespace {
+
+	// Speed 10^-3y along x with a small swirl, defined inside the unit cube.
+	struct ShearField {
+		bool operator()( const Vec3& p, Vec3& v ) const {
+			if( p.x < 0.0 || p.x > 1.0 || p.y < 0.0 || p.y > 1.0 || p.z < 0.0 || p.z > 1.0 ) return false;
+			double speed = std::pow( 10.0, -3.0 * p.y );
+			v = Vec3{ speed, 1e-3 * speed * std::sin( 20.0 * p.z ), 1e-3 * speed * std::cos( 20.0 * p.x ) };
+			return true;
+		}
+	};
+
+	double seconds( std::chrono::steady_clock::time_point start ) {
+		return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+	}
+
+	// One line from seed, returns the number of steps.
+	size_t line( Vec3& x, double stepSize, size_t maxSteps ) {
+		ShearField field;
+		integration::RK4< Vec3 > stepper( stepSize );
+		integration::StepLimit limit( maxSteps );
+		auto sink = []( const Vec3& ) {};
+		return integration::integrateLine( stepper, field, x, limit, sink );
+	}
+}
+
+int main( int argc, char** argv ) {
+	size_t numSeeds = argc > 1 ? std::atol( argv[1] ) : 2000;
+	size_t maxSteps = argc > 2 ? std::atol( argv[2] ) : 100000;
+	const double stepSize = 0.01;
+	const int numThreads = omp_get_max_threads();
+
+	// lines get longer with y, the longest are handed out last
+	std::vector< Vec3 > seeds( numSeeds );
+	for( size_t s=0; s<numSeeds; s++ ) {
+		double t = ( s + 0.5 ) / numSeeds;
+		seeds[s] = Vec3{ 0.0, 0.01 + 0.99 * t * t * t * t, 0.5 };
+	}
+
+	std::vector< Vec3 > reference( seeds );
+	std::vector< size_t > lengths( numSeeds );
+	auto start = std::chrono::steady_clock::now();
+	size_t totalSteps = 0;
+	for( size_t s=0; s<numSeeds; s++ ) {
+		lengths[s] = line( reference[s], stepSize, maxSteps );
+		totalSteps += lengths[s];
+	}
+	double serial = seconds( start );
+	size_t longest = *std::max_element( lengths.begin(), lengths.end() );
+	double ideal = std::max( serial / numThreads, serial * longest / totalSteps );
+
+	std::printf( "%zu seeds, %zu to %zu steps of RK4, %zu in total, %d threads\n", numSeeds, *std::min_element( lengths.begin(), lengths.end() ), longest, totalSteps, numThreads );
+	std::printf( "%8s %10s %10s\n", "variant", "seconds", "of ideal" );
+	std::printf( "%8s %10.3f %10.2f\n", "serial", serial, serial / ideal );
+
+	auto report = [&]( const char* name, double time, const std::vector< Vec3 >& ends ) {
+		size_t different = 0;
+		for( size_t s=0; s<numSeeds; s++ ) {
+			if( ends[s].x != reference[s].x || ends[s].y != reference[s].y || ends[s].z != reference[s].z ) different++;
+		}
+		std::printf( "%8s %10.3f %10.2f", name, time, time / ideal );
+		if( different ) std::printf( "  %zu lines differ from serial", different );
+		std::printf( "\n" );
+	};
+
+	std::vector< Vec3 > ends( seeds );
+	start = std::chrono::steady_clock::now();
+	#pragma omp parallel for
+	for( long long s=0; s<(long long)numSeeds; s++ ) line( ends[s], stepSize, maxSteps );
+	report( "static", seconds( start ), ends );
+
+	ends = seeds;
+	start = std::chrono::steady_clock::now();
+	#pragma omp parallel for schedule( dynamic )
+	for( long long s=0; s<(long long)numSeeds; s++ ) line( ends[s], stepSize, maxSteps );
+	report( "dynamic", seconds( start ), ends );
+
+	ends = seeds;
+	auto makeSink = [&ends]( size_t s, const Vec3& ) {
+		Vec3* end = &ends[s];
+		return [end]( const Vec3& x ) { *end = x; };
+	};
+	start = std::chrono::steady_clock::now();
+	integration::integrateLines( integration::RK4< Vec3 >( stepSize ), false, seeds, maxSteps, nullptr,
+								 []() { return ShearField(); }, makeSink, []( size_t, size_t ) {} );
+	report( "pool", seconds( start ), ends );
+
+	std::printf( "\n%8s %10s %10s %12s\n", "output", "seconds", "merge", "points" );
+	auto makeField = []() { return ShearField(); };
+	auto noProgress = []( size_t, size_t ) {};
+	integration::RK4< Vec3 > stepper( stepSize );
+
+	start = std::chrono::steady_clock::now();
+	std::vector< std::vector< Vec3 > > lines( numSeeds );
+	for( size_t s=0; s<numSeeds; s++ ) lines[s].push_back( seeds[s] );
+	auto makeLineSink = [&lines]( size_t s, const Vec3& ) {
+		std::vector< Vec3 >* line = &lines[s];
+		return [line]( const Vec3& x ) { line->push_back( x ); };
+	};
+	integration::integrateLines( stepper, false, seeds, maxSteps, nullptr, makeField, makeLineSink, noProgress );
+	auto merge = std::chrono::steady_clock::now();
+	std::vector< Vec3 > vertices;
+	std::vector< size_t > offsets( 1, 0 );
+	size_t numPoints = 0;
+	for( size_t s=0; s<numSeeds; s++ ) numPoints += lines[s].size();
+	vertices.reserve( numPoints );
+	for( size_t s=0; s<numSeeds; s++ ) {
+		vertices.insert( vertices.end(), lines[s].begin(), lines[s].end() );
+		offsets.push_back( vertices.size() );
+	}
+	std::printf( "%8s %10.3f %10.3f %12zu\n", "vectors", seconds( start ), seconds( merge ), vertices.size() );
+	// keep a checksum, so that both variants start with the same free memory
+	double checksum = 0.0;
+	for( size_t i=0; i<vertices.size(); i++ ) checksum += ( i % 7 ) * vertices[i].x + vertices[i].y + 3.0 * vertices[i].z;
+	lines = std::vector< std::vector< Vec3 > >();
+	vertices = std::vector< Vec3 >();
+
+	start = std::chrono::steady_clock::now();
+	LineArena< Vec3 > arena( numSeeds );
+	for( size_t s=0; s<numSeeds; s++ ) arena.push( s, seeds[s] );
+	auto makeArenaSink = [&arena]( size_t s, const Vec3& ) {
+		return [&arena, s]( const Vec3& x ) { arena.push( s, x ); };
+	};
+	integration::integrateLines( stepper, false, seeds, maxSteps, nullptr, makeField, makeArenaSink, noProgress );
+	merge = std::chrono::steady_clock::now();
+	std::vector< Vec3 > merged;
+	std::vector< size_t > mergedOffsets;
+	arena.merge( merged, mergedOffsets );
+	std::printf( "%8s %10.3f %10.3f %12zu", "arena", seconds( start ), seconds( merge ), merged.size() );
+	double mergedChecksum = 0.0;
+	for( size_t i=0; i<merged.size(); i++ ) mergedChecksum += ( i % 7 ) * merged[i].x + merged[i].y + 3.0 * merged[i].z;
+	if( mergedOffsets != offsets || mergedChecksum != checksum ) std::printf( "  differs from vectors" );
+	std::printf( "\n" );
+
+	start = std::chrono::steady_clock::now();
+	SimplifyStats stats = simplifyLines( merged, mergedOffsets, 1e-4 );
+	std::printf( "%8s %10.3f %10s %12zu  %.1fx fewer, max deviation %g\n", "simplify", seconds( start ), "", stats.outputVertices, stats.reduction(), stats.maxDeviation );
+
+	return 0;
+}
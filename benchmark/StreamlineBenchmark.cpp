@@ -0,0 +1,244 @@
+// Measures the speed and accuracy of the streamline integrators on analytic fields, so that
+// versions can be compared. Runs without fantom and without the GUI.
+//
+// Build and run:
+//   g++ -std=c++17 -O2 -fopenmp -I.. StreamlineBenchmark.cpp -o streamline-bench
+//   OMP_NUM_THREADS=8 ./streamline-bench [gridSize] [numSeeds] [stepsPerLine] [results.csv]
+//
+// Every field is sampled at the points of a gridSize^3 grid over its domain and interpolated
+// trilinearly by StructuredVectorField, on a uniform grid and on a curvilinear grid whose inner
+// points are displaced by up to a third of a cell:
+//   rotation     solid-body rotation about z in [-1,1]^3, for one revolution
+//   abc          Arnold-Beltrami-Childress flow in [0,2pi]^3, for time 0.5
+//   double-gyre  steady double gyre (A = 0.1) in [0,2]x[0,1]x[0,1], for time 10
+// Every line takes stepsPerLine steps of duration / stepsPerLine. The integrators are the
+// cores of the algorithms, scheduled on the pool by integrateLines like there:
+//   Euler          Euler.cpp, Euler with the step as arc length
+//   RungeKutta     Runge-Kutta.cpp, RK4
+//   RK4-packets    Runge-Kutta.cpp on uniform grids, integratePacketsRK4
+//   IntegratorOwn  IntegratorOwn with RK45, adaptive within 1e-6 and stopped at the duration
+// Each runs with 1, 2, 4, ... threads up to OMP_NUM_THREADS. The error is the distance of the
+// line ends to the analytic solution of the rotation, and to lines integrated with RK4 and a
+// sixteenth of the step in the analytic field for the other two, so it includes the error of
+// sampling the field onto the grid. Every run is also written as a row of results.csv, by
+// default streamline-bench.csv.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "../IntegrationCore.hpp"
+#include "../IntegrationTasks.hpp"
+#include "../PacketIntegration.hpp"
+#include "AnalyticFields.hpp"
+
+using namespace fantom;
+using namespace benchmark;
+
+namespace {
+
+	// Integration core field as HintedField samples, counting its evaluations.
+	struct SampledField {
+		const StructuredVectorField& field;
+		size_t& evaluations;
+		size_t hint;
+		size_t cell[3];
+
+		bool operator()( const Vec3& p, Vec3& v ) {
+			evaluations++;
+			const double x[3] = { p.x, p.y, p.z };
+			double local[3];
+			if( !field.grid().locate( x, hint, cell, local ) ) return false;
+			v = field.interpolate< Vec3 >( cell, local );
+			return true;
+		}
+	};
+
+	struct alignas( 64 ) Counter {
+		size_t evaluations;
+	};
+
+	// Seeds spread evenly over the seed box by an additive recurrence.
+	std::vector< Vec3 > makeSeeds( const Flow& flow, size_t numSeeds ) {
+		std::vector< Vec3 > seeds( numSeeds );
+		const double g = 1.22074408460575947536;
+		const double alpha[3] = { 1.0 / g, 1.0 / ( g * g ), 1.0 / ( g * g * g ) };
+		for( size_t s=0; s<numSeeds; s++ ) {
+			double t[3];
+			for( size_t d=0; d<3; d++ ) t[d] = std::fmod( 0.5 + alpha[d] * ( s + 1 ), 1.0 );
+			seeds[s] = Vec3{ flow.seedLower.x + t[0] * ( flow.seedUpper.x - flow.seedLower.x ),
+							 flow.seedLower.y + t[1] * ( flow.seedUpper.y - flow.seedLower.y ),
+							 flow.seedLower.z + t[2] * ( flow.seedUpper.z - flow.seedLower.z ) };
+		}
+		return seeds;
+	}
+
+	// Ends of the lines in the analytic flow after duration, as time or with normalize set as
+	// arc length. The rotation is solved exactly, the others with RK4 and a sixteenth of step.
+	std::vector< Vec3 > solve( const Flow& flow, const std::vector< Vec3 >& seeds, double duration, size_t steps, bool normalize ) {
+		std::vector< Vec3 > ends( seeds );
+		#pragma omp parallel for schedule( dynamic, 16 )
+		for( long long s=0; s<(long long)seeds.size(); s++ ) {
+			Vec3& x = ends[s];
+			if( std::string( flow.name ) == "rotation" ) {
+				const double radius = std::sqrt( x.x * x.x + x.y * x.y );
+				const double angle = normalize ? duration / radius : duration;
+				x = Vec3{ std::cos( angle ) * x.x - std::sin( angle ) * x.y, std::sin( angle ) * x.x + std::cos( angle ) * x.y, x.z };
+				continue;
+			}
+			AnalyticField field{ flow };
+			integration::Normalized< AnalyticField > direction( field );
+			integration::RK4< Vec3 > stepper( duration / ( 16 * steps ) );
+			integration::StepLimit limit( 16 * steps );
+			auto sink = []( const Vec3& ) {};
+			if( normalize ) integration::integrateLine( stepper, direction, x, limit, sink );
+			else integration::integrateLine( stepper, field, x, limit, sink );
+		}
+		return ends;
+	}
+
+	struct Result {
+		double seconds;
+		size_t steps;
+		size_t evaluations;
+		double maxError;
+		double meanError;
+	};
+
+	double seconds( std::chrono::steady_clock::time_point start ) {
+		return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+	}
+
+	void measureError( const std::vector< Vec3 >& ends, const std::vector< Vec3 >& reference, Result& result ) {
+		result.maxError = 0.0;
+		result.meanError = 0.0;
+		for( size_t s=0; s<ends.size(); s++ ) {
+			double error = norm( ends[s] - reference[s] );
+			result.maxError = std::max( result.maxError, error );
+			result.meanError += error / ends.size();
+		}
+	}
+
+	// Integrates seeds on the pool like the algorithms do, with stepper copied per line.
+	template< typename Stepper >
+	Result runLines( const StructuredVectorField& field, const std::vector< Vec3 >& seeds, const Stepper& stepper, bool normalize, size_t maxSteps,
+					 const std::vector< Vec3 >& reference ) {
+		std::vector< Counter > counters( omp_get_max_threads() );
+		for( Counter& counter : counters ) counter.evaluations = 0;
+		std::vector< Vec3 > ends( seeds );
+		auto makeField = [&]() { return SampledField{ field, counters[ omp_get_thread_num() ].evaluations, StructuredGrid::none, { 0, 0, 0 } }; };
+		auto makeSink = [&ends]( size_t s, const Vec3& ) {
+			Vec3* end = &ends[s];
+			return [end]( const Vec3& x ) { *end = x; };
+		};
+
+		Result result;
+		auto start = std::chrono::steady_clock::now();
+		result.steps = integration::integrateLines( stepper, normalize, seeds, maxSteps, nullptr, makeField, makeSink, []( size_t, size_t ) {} );
+		result.seconds = seconds( start );
+		result.evaluations = 0;
+		for( const Counter& counter : counters ) result.evaluations += counter.evaluations;
+		measureError( ends, reference, result );
+		return result;
+	}
+
+	Result runPackets( const StructuredVectorField& field, const std::vector< Vec3 >& seeds, double stepSize, size_t steps, const std::vector< Vec3 >& reference ) {
+		std::vector< double > packetSeeds;
+		for( const Vec3& seed : seeds ) {
+			packetSeeds.push_back( seed.x );
+			packetSeeds.push_back( seed.y );
+			packetSeeds.push_back( seed.z );
+		}
+		std::vector< Vec3 > ends( seeds );
+		auto sink = [&ends]( size_t seed, const double x[3] ) { ends[seed] = Vec3{ x[0], x[1], x[2] }; };
+
+		Result result;
+		auto start = std::chrono::steady_clock::now();
+		result.steps = integration::integratePacketsRK4( field, packetSeeds, stepSize, steps, nullptr, sink, []( size_t, size_t ) {} );
+		result.seconds = seconds( start );
+		// a packet step evaluates all four stages of every lane
+		result.evaluations = 4 * result.steps;
+		measureError( ends, reference, result );
+		return result;
+	}
+}
+
+int main( int argc, char** argv ) {
+	size_t gridSize = argc > 1 ? std::atol( argv[1] ) : 64;
+	size_t numSeeds = argc > 2 ? std::atol( argv[2] ) : 1000;
+	size_t stepsPerLine = argc > 3 ? std::atol( argv[3] ) : 1000;
+	const char* csvPath = argc > 4 ? argv[4] : "streamline-bench.csv";
+	if( gridSize < 2 || numSeeds < 1 || stepsPerLine < 1 ) {
+		std::fprintf( stderr, "usage: %s [gridSize >= 2] [numSeeds >= 1] [stepsPerLine >= 1] [results.csv]\n", argv[0] );
+		return 1;
+	}
+
+	const int maxThreads = omp_get_max_threads();
+	std::vector< int > threadCounts;
+	for( int t=1; t<maxThreads; t*=2 ) threadCounts.push_back( t );
+	threadCounts.push_back( maxThreads );
+
+	FILE* csv = std::fopen( csvPath, "w" );
+	if( !csv ) {
+		std::fprintf( stderr, "can't write %s\n", csvPath );
+		return 1;
+	}
+	std::fprintf( csv, "field,grid,grid_size,integrator,threads,seeds,steps,evaluations,seconds,steps_per_s,evals_per_s,speedup,max_error,mean_error\n" );
+
+	std::printf( "grid %zu^3, %zu seeds, %zu steps per line, up to %d threads\n", gridSize, numSeeds, stepsPerLine, maxThreads );
+	std::printf( "%-12s %-12s %-14s %7s %9s %13s %13s %8s %11s %11s\n", "field", "grid", "integrator", "threads", "seconds", "steps/s", "evals/s", "speedup", "max error", "mean error" );
+
+	for( const Flow& flow : flows() ) {
+		const std::vector< Vec3 > seeds = makeSeeds( flow, numSeeds );
+		const double stepSize = flow.duration / stepsPerLine;
+		const std::vector< Vec3 > reference = solve( flow, seeds, flow.duration, stepsPerLine, false );
+		const std::vector< Vec3 > arcReference = solve( flow, seeds, flow.duration, stepsPerLine, true );
+
+		// RK45 as IntegratorOwn sets it up, ending every line at the duration
+		integration::Tolerance tolerance;
+		tolerance.absolute = 1e-6;
+		tolerance.relative = 1e-6;
+		tolerance.minStep = stepSize * 1e-3;
+		tolerance.maxStep = stepSize * 10;
+		integration::AdaptiveRK45< Vec3 > rk45( stepSize, tolerance );
+		rk45.setDuration( flow.duration );
+
+		for( bool curvilinear : { false, true } ) {
+			std::shared_ptr< const StructuredVectorField > field = sample( flow, gridSize, curvilinear );
+			const char* gridName = curvilinear ? "curvilinear" : "uniform";
+
+			auto measure = [&]( const char* integrator, std::function< Result() > run ) {
+				double serial = 0.0;
+				for( int threads : threadCounts ) {
+					omp_set_num_threads( threads );
+					Result r = run();
+					if( threads == 1 ) serial = r.seconds;
+					double speedup = serial / r.seconds;
+					std::printf( "%-12s %-12s %-14s %7d %9.3f %13.0f %13.0f %8.2f %11.3g %11.3g\n", flow.name, gridName, integrator, threads,
+								 r.seconds, r.steps / r.seconds, r.evaluations / r.seconds, speedup, r.maxError, r.meanError );
+					std::fprintf( csv, "%s,%s,%zu,%s,%d,%zu,%zu,%zu,%.6f,%.1f,%.1f,%.4f,%.6g,%.6g\n", flow.name, gridName, gridSize, integrator, threads, numSeeds,
+								  r.steps, r.evaluations, r.seconds, r.steps / r.seconds, r.evaluations / r.seconds, speedup, r.maxError, r.meanError );
+				}
+				omp_set_num_threads( maxThreads );
+			};
+
+			measure( "Euler", [&]() { return runLines( *field, seeds, integration::Euler< Vec3 >( stepSize ), true, stepsPerLine, arcReference ); } );
+			measure( "RungeKutta", [&]() { return runLines( *field, seeds, integration::RK4< Vec3 >( stepSize ), false, stepsPerLine, reference ); } );
+			if( integration::supportsPackets( *field ) ) {
+				measure( "RK4-packets", [&]() { return runPackets( *field, seeds, stepSize, stepsPerLine, reference ); } );
+			}
+			measure( "IntegratorOwn", [&]() { return runLines( *field, seeds, rk45, false, 100 * stepsPerLine, reference ); } );
+		}
+	}
+
+	std::fclose( csv );
+	std::printf( "results written to %s\n", csvPath );
+	return 0;
+}
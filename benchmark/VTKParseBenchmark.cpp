@@ -0,0 +1,90 @@
+// Measures how parsing of ASCII legacy VTK files scales with the number of threads.
+//
+// Build and run without fantom:
+//   g++ -std=c++17 -O2 -fopenmp -I.. VTKParseBenchmark.cpp -o vtkparse-bench
+//   ./vtkparse-bench [numPoints] [file.vtk]
+//
+// Without a file argument a synthetic structured grid with a vector field is written to
+// /tmp first. Every parallel run is compared against the serial streaming parse.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "../VTKReader.hpp"
+
+using namespace fantom;
+
+namespace {
+
+	void writeSyntheticFile( const std::string& path, size_t numPoints ) {
+		size_t n = 1;
+		while( n * n * n < numPoints ) n++;
+
+		std::FILE* file = std::fopen( path.c_str(), "w" );
+		std::fprintf( file, "# vtk DataFile Version 3.0\nsynthetic\nASCII\nDATASET STRUCTURED_GRID\n" );
+		std::fprintf( file, "DIMENSIONS %zu %zu %zu\nPOINTS %zu float\n", n, n, n, n * n * n );
+
+		std::mt19937 rng( 42 );
+		std::uniform_real_distribution< float > jitter( -0.01f, 0.01f );
+		for( size_t k=0; k<n; k++ ) {
+			for( size_t j=0; j<n; j++ ) {
+				for( size_t i=0; i<n; i++ ) {
+					std::fprintf( file, "%g %g %g\n", i + jitter( rng ), j + jitter( rng ), k + jitter( rng ) );
+				}
+			}
+		}
+
+		std::fprintf( file, "\nPOINT_DATA %zu\nVECTORS velocity float\n", n * n * n );
+		std::uniform_real_distribution< float > value( -10.0f, 10.0f );
+		for( size_t i=0; i<n*n*n; i++ ) {
+			std::fprintf( file, "%.7g %.7g %.7g\n", value( rng ), value( rng ), value( rng ) );
+		}
+		std::fclose( file );
+	}
+
+	double load( const std::string& path, int numThreads, VtkDataset& data ) {
+		VtkLegacyReader reader;
+		reader.setNumThreads( numThreads );
+
+		auto start = std::chrono::steady_clock::now();
+		if( !reader.read( path, data ) ) {
+			std::cerr << "Failed to read " << path << ": " << reader.error() << std::endl;
+			std::exit( 1 );
+		}
+		return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+	}
+
+}
+
+int main( int argc, char** argv ) {
+	size_t numPoints = argc > 1 ? std::strtoull( argv[1], nullptr, 10 ) : 2000000;
+	std::string path = argc > 2 ? argv[2] : "/tmp/vtkparse-bench.vtk";
+	if( argc <= 2 ) writeSyntheticFile( path, numPoints );
+
+	MappedFile file( path );
+	double megabytes = file.size() / ( 1024.0 * 1024.0 );
+
+	VtkDataset reference;
+	double serial = load( path, 1, reference );
+	std::printf( "%8s %10s %10s %8s\n", "threads", "seconds", "MB/s", "speedup" );
+	std::printf( "%8d %10.3f %10.1f %8.2f\n", 1, serial, megabytes / serial, 1.0 );
+
+	int maxThreads = 1;
+#ifdef _OPENMP
+	maxThreads = omp_get_max_threads();
+#endif
+	for( int threads=2; threads<=maxThreads; threads*=2 ) {
+		VtkDataset data;
+		double seconds = load( path, threads, data );
+		if( data.points != reference.points || data.arrays[0].values != reference.arrays[0].values ) {
+			std::cerr << "Parallel parse with " << threads << " threads differs from the serial parse" << std::endl;
+			return 1;
+		}
+		std::printf( "%8d %10.3f %10.1f %8.2f\n", threads, seconds, megabytes / seconds, serial / seconds );
+	}
+	return 0;
+}